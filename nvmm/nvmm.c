@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 
 
 
@@ -37,46 +38,226 @@
 
 
 #define NVMM_PAGE_SIZE_DEFAULT			2048			//default set to 2K, should adjust based on the platform you are using.
+#define NVMM_ERASE_SIZE_DEFAULT			0				//0 for the same as page size.
+#define NVMM_PROGRAM_PAGE_SIZE_DEFAULT	0				//0 for no program page limit, the same as MCU internal flash.
+#define NVMM_PROGRAM_UNIT_DEFAULT		4				//bytes per write_nvwords unit, a word.
+#define NVMM_PROGRAM_UNIT_MAX			32				//256bits flash word of STM32H7.
 #define NVMM_PAGE_A_ID_DEFAULT			1				//use the 8th page as page A.
 #define NVMM_PAGE_B_ID_DEFAULT       	2				//use the 9th page as page B.
 
+#define NVMM_GROUP_HOT					0				//the page group written by default.
+#define NVMM_GROUP_COLD					1				//the page group of the items seldom written.
+#define NVMM_GROUP_NUM					2
+
 
 #define NVMM_LINE_DELIMITER				0xAAAAAAAA
+#define NVMM_FRAGMENT_DELIMITER			0xA5A5A5A5		//a fragment of the line right above it, not a line on its own.
+
+/*
+ * a value of inline_max bytes or less is kept inline, in the line header slot without the data part,
+ * and the delimiter word carries the inline mark, the value length and the line id instead.
+ */
+#define NVMM_INLINE_MARK				0xAA
+#define INLINE_DELIMITER(id, len)			(((uint32_t )NVMM_INLINE_MARK << 24) | ((uint32_t )(len) << 16) | (id))
+#define INLINE_ID(delimiter)				((uint16_t )((delimiter) & 0xFFFF))
+#define INLINE_LENGTH(delimiter)			(((delimiter) >> 16) & 0xFF)
+#define IS_INLINE_DELIMITER(delimiter)	((delimiter) >> 24 == NVMM_INLINE_MARK && INLINE_LENGTH(delimiter) != 0 && \
+											INLINE_LENGTH(delimiter) <= inline_max && IS_LINEID_LEGAL(INLINE_ID(delimiter)))
 #define NVMM_LINE_MAXID					0x8000
+
+/*
+ * a compressed value is stored as its length and the LZ tokens, in groups of 8tokens led by a control byte,
+ * a control bit set for a match(distance - 1, length - NVMM_COMPRESS_MINMATCH), cleared for a literal byte.
+ * the last line of a compressed value has the flag on the id.
+ */
+#define NVMM_COMPRESSED_FLAG			0x8000
+#define NVMM_COMPRESS_WINDOW			256
+#define NVMM_COMPRESS_MINMATCH			3
+#define NVMM_COMPRESS_MAXMATCH			(0xFF + NVMM_COMPRESS_MINMATCH)
+#define NVMM_COMPRESS_GROUP				8
+
+/*
+ * a defrag writes an index line on top of the lines it copies, holding their header slots sorted by id,
+ * so a lookup binary searches them once it has walked down the lines written since.
+ * with checkpoints set, an index line is also appended every few lines written, merging the index below
+ * with the lines on top of it, so a lookup never walks down more than those few lines.
+ * the index is left out for a few lines only.
+ */
+#define NVMM_INDEX_DELIMITER			0x5A5A5A5A
+#define NVMM_INDEX_ID					0xFFFE
+#define NVMM_INDEX_MIN					8
+#define IS_INDEX_DELIMITER(delimiter)		(delimiter == NVMM_INDEX_DELIMITER)
+
+/*
+ * the bloom filter sets NVMM_BLOOM_HASHES bits for every id written, an id with any of them clear was never written.
+ */
+#define NVMM_BLOOM_HASHES				3
+
+#define NVMM_RETAIN_MARK				0x4E564D4D		//"NVMM", the retained mount state is kept up to date.
+
+/*
+ * a value already held by another line is stored as a reference to that line,
+ * a compressed value whose length has the reference mark.
+ */
+#define NVMM_REFERENCE_MARK				0x80000000
+
+/*
+ * compact line header, a word of 2half words programmed in 2stages.
+ * the low half, 12bits length and a check nibble, goes first like the length stage of the standard header,
+ * the high half, 12bits id and a check nibble, commits the line. the id check nibble is inverted for a fragment,
+ * and half inverted for the last line of a compressed value.
+ * the compact page has the mark in place of the dummy line header.
+ * an index line has the id check nibble xor 0x5.
+ */
+#define NVMM_COMPACT_PAGE_MARK			0x5555CAFE
+#define NVMM_COMPACT_MAXID				0x0FFF
+#define NVMM_COMPACT_MAXLENGTH			0x1000
+#define COMPACT_CHECK(v)					((((v) ^ ((v) >> 4) ^ ((v) >> 8)) & 0xF) ^ 0x5)
+#define COMPACT_LOW(len)					((uint16_t )((len) | COMPACT_CHECK(len) << 12))
+#define COMPACT_KIND(id, delimiter)		(((delimiter) == NVMM_FRAGMENT_DELIMITER)? 0xF : \
+											((delimiter) == NVMM_INDEX_DELIMITER)? 0x5 : \
+											((id) & NVMM_COMPRESSED_FLAG)? 0xA : 0)
+#define COMPACT_HIGH(id, len, delimiter)	((uint16_t )(((id) & NVMM_COMPACT_MAXID) | \
+											(COMPACT_CHECK(((id) & NVMM_COMPACT_MAXID) ^ (len)) ^ \
+											COMPACT_KIND(id, delimiter)) << 12))
+#if (NVMM_ADDRESS_WIDTH == 32)
+#define NVMM_LINE_MAXLENGTH				0x80000000
+#define NVMM_PAGE_SIZE_MAX				0x80000000
+#else
 #define NVMM_LINE_MAXLENGTH				0x8000
+#define NVMM_PAGE_SIZE_MAX				0xFFFC			//offsets up to the page end fit in 16bits, 0xFFFF is the default.
+#endif
 
-#define IS_LINEID_LEGAL(id)				(id < NVMM_LINE_MAXID)
+#define IS_LINEID_LEGAL(id)				(id < (compact? NVMM_COMPACT_MAXID : NVMM_LINE_MAXID))
 #define IS_LINELENGTH_LEGAL(len)			(len < NVMM_LINE_MAXLENGTH)
 #define IS_LINEDELIMITER_LEGAL(delimiter)	(delimiter == NVMM_LINE_DELIMITER)
-#define PAD_LENGTH(len)					(((len + sizeof(uint32_t) - 1) / sizeof(uint32_t)) * sizeof(uint32_t))
-#define FLASH_ADDRESS(pageid, offset)		((uint32_t )pageid * page_size + offset)
+#define PAD_LENGTH(len)					((((len) + line_align - 1) / line_align) * line_align)
+#define FLASH_ADDRESS(pageid, offset)		((uint32_t )(pageid) * page_size + (offset))
 
-static read_nvbytes_t read_nvbytes = 0 ;
-static write_nvwords_t write_nvwords = 0 ;
-static erase_nvpage_t erase_nvpage = 0 ;
+/*
+ * bytes buffered on stack when nvmm copies, verifies or blank checks flash.
+ * larger buffer means less flash method calls, which matters on external flash.
+ */
+#ifndef NVMM_IO_BUFFER_SIZE
+#define NVMM_IO_BUFFER_SIZE				64
+#endif
+#if (NVMM_IO_BUFFER_SIZE % NVMM_PROGRAM_UNIT_MAX)
+#error "NVMM_IO_BUFFER_SIZE must be a multiple of NVMM_PROGRAM_UNIT_MAX"
+#endif
 
-static uint16_t activedpage = 0xFFFF ;
-static uint16_t ctindex = 0 ;	//content index.
+/*
+ * programs of a line collected for a vectored write, in segments and in bytes copied.
+ */
+#ifndef NVMM_VECTOR_SEGMENTS
+#define NVMM_VECTOR_SEGMENTS			8
+#endif
+#ifndef NVMM_VECTOR_SIZE
+#define NVMM_VECTOR_SIZE				64
+#endif
 
-static uint16_t page_a_id = NVMM_PAGE_A_ID_DEFAULT ;
-static uint16_t page_b_id = NVMM_PAGE_B_ID_DEFAULT ;
+/*
+ * flash programming a word(or a half word) at a time can program the same word again to clear more bits,
+ * so a line header is committed in stages, id after the data and the delimiter at last.
+ * flash programming wider units is ECC protected and a unit can't be programmed twice,
+ * so the data goes first and then the whole line header in one program.
+ */
+#define IS_STAGED_COMMIT()				(program_unit <= sizeof(uint32_t))
 
-static uint16_t page_size = NVMM_PAGE_SIZE_DEFAULT ;
+/*
+ * the wear record, the erase counts of the page and of the other page of the pair, goes right behind the state
+ * (behind the dummy mark without staged commit) and is programmed before the state activates the page.
+ * its mark tells the line header format as well. a page written before the erase counts has no wear record,
+ * it's read as a legacy format and converted by the next defrag.
+ */
+#define NVMM_WEAR_PAGE_MARK				0x3333CAFE
+#define NVMM_COMPACT_WEAR_PAGE_MARK		0x6666CAFE
+#define NVMM_HEADER_LEGACY				0x80			//format flag of a page without the wear record.
+#define NVMM_ENDURANCE_DEFAULT			10000			//erase cycles, the usual rating of MCU internal flash.
+#define WEAR_OFFSET()					(IS_STAGED_COMMIT()? sizeof(uint32_t) : line_align * 2)
+#define WEAR_SPAN()						PAD_LENGTH(sizeof(nvmm_wear_record_t))
+#define FORMAT_IN_USE()					((compact? NVMM_HEADER_COMPACT : NVMM_HEADER_STANDARD) | \
+											(wear_record? 0 : NVMM_HEADER_LEGACY))
 
 /*
  * NVMM line header.
  */
+#if (NVMM_ADDRESS_WIDTH == 32)
+typedef struct{
+	uint16_t id ;
+	uint16_t reserved ;		//left erased.
+	uint32_t len ;
+	uint32_t delimiter ;
+}nvmm_lineheader_t ;
+#else
 typedef struct{
 	uint16_t id ;
 	uint16_t len ;
 	uint32_t delimiter ;
 }nvmm_lineheader_t ;
+#endif
+
+
+
+
+/*
+ * NVMM line, decoded from the line header slot.
+ */
+typedef struct{
+	uint16_t id ;
+	nvmm_off_t len ;		//value length.
+	nvmm_off_t data ;		//value offset, inside the header slot for an inline line.
+	nvmm_off_t bottom ;		//the lowest offset the line takes.
+	uint32_t delimiter ;	//NVMM_LINE_DELIMITER for a line, inline ones included, NVMM_FRAGMENT_DELIMITER for a fragment.
+	uint8_t compressed ;	//the line commits a compressed value or a reference, the flag is taken off the id.
+}nvmm_line_t ;
+
+
+/*
+ * NVMM item, the pieces of a chunked one are the fragment lines below the line committing it.
+ */
+typedef struct{
+	nvmm_off_t first ;		//data offset of the 1st piece.
+	nvmm_off_t slot ;		//header slot of the page format.
+	nvmm_off_t fragments ;
+	nvmm_off_t piece_len ;	//fragment length.
+	size_t total ;			//stored length.
+	uint8_t compressed ;
+}nvmm_item_t ;
+
+
+/*
+ * NVMM reference, the value of a line referring to the line that holds the same value.
+ */
+typedef struct{
+	uint32_t size ;		//value length with NVMM_REFERENCE_MARK.
+	uint32_t hash ;		//value checksum, references to the same value are told by it.
+	uint32_t slot ;		//header slot offset of the line holding the value, it's always an earlier line.
+}nvmm_reference_t ;
+
+
+/*
+ * NVMM index entry.
+ */
+#if (NVMM_ADDRESS_WIDTH == 32)
+typedef struct{
+	uint16_t id ;
+	uint16_t reserved ;
+	nvmm_off_t slot ;	//header slot offset of the line.
+}nvmm_index_t ;
+#else
+typedef struct{
+	uint16_t id ;
+	nvmm_off_t slot ;	//header slot offset of the line.
+}nvmm_index_t ;
+#endif
 
 
 
 
 /*
  * NVMM page header.
+ * for staged commit flash. otherwise the state, a dummy mark and the dummy line header
+ * take a line_align slot each, the mark is programmed to 0 instead of the state when the page becomes dummy.
  */
 typedef struct{
 	uint32_t state ;
@@ -84,481 +265,3748 @@ typedef struct{
 	nvmm_lineheader_t dummy ;	//dummy line header, just put behind the page head id and store nothing.
 }nvmm_pageheader_t ;
 
+/*
+ * NVMM wear record.
+ * a page loses its erase count when it's erased, so the active page also keeps the count of the other page,
+ * with the erase that follows the activation.
+ */
+typedef struct{
+	uint32_t mark ;
+	uint32_t erases ;			//erases of this page.
+	uint32_t spare_erases ;		//erases of the other page of the pair.
+}nvmm_wear_record_t ;
 
 
 
-static void locate_ctindex(void)
+
+static read_nvbytes_t read_nvbytes = 0 ;
+static write_nvwords_t write_nvwords = 0 ;
+static erase_nvpage_t erase_nvpage = 0 ;
+static readv_nvbytes_t readv_nvbytes = 0 ;
+static writev_nvwords_t writev_nvwords = 0 ;
+
+static nvmm_segment_t pending[NVMM_VECTOR_SEGMENTS] ;		//programs collected for the vectored write.
+static uint8_t pending_data[NVMM_VECTOR_SIZE] ;
+static size_t pending_num = 0 ;
+static size_t pending_used = 0 ;
+static uint8_t collecting = 0 ;		//a line is being written, its programs are collected.
+
+static uint16_t activedpage = 0xFFFF ;
+static nvmm_off_t ctindex = 0 ;	//content index.
+
+static uint16_t page_a_id = NVMM_PAGE_A_ID_DEFAULT ;
+static uint16_t page_b_id = NVMM_PAGE_B_ID_DEFAULT ;
+
+static nvmm_off_t page_size = NVMM_PAGE_SIZE_DEFAULT ;
+static nvmm_off_t erase_size = NVMM_ERASE_SIZE_DEFAULT ;
+static nvmm_off_t program_page_size = NVMM_PROGRAM_PAGE_SIZE_DEFAULT ;
+static uint16_t program_unit = NVMM_PROGRAM_UNIT_DEFAULT ;
+
+static nvmm_off_t line_align = sizeof(uint32_t) ;				//lines are aligned to the program unit, at least a word.
+static nvmm_off_t header_slot = sizeof(nvmm_lineheader_t) ;		//line header padded to line_align.
+static nvmm_off_t page_base = sizeof(nvmm_pageheader_t) ;		//the 1st line offset, right behind the page header.
+static uint8_t tail_dirty = 0 ;		//something's programmed behind ctindex, the next write needs a clean page.
+static nvmm_off_t inline_offset = 0 ;	//inline value offset in the header slot.
+static nvmm_off_t inline_max = offsetof(nvmm_lineheader_t, delimiter) ;	//longest inline value.
+static uint8_t header_format = NVMM_HEADER_STANDARD ;	//the format of the pages created.
+static uint8_t compact = 0 ;		//the page in use has compact line headers.
+static uint8_t wear_record = 1 ;	//the page in use has the wear record.
+static uint32_t erases = 0 ;		//erase count of the active page.
+static uint32_t spare_erases = 0 ;	//erase count of the other page.
+static uint32_t mount_defrags = 0 ;	//defrags since mounted.
+static uint32_t mount_written = 0 ;	//bytes of lines written since mounted.
+static size_t reserving = 0 ;		//room the defrag in progress has to leave for the line it's made for.
+static nvmm_off_t settled = 0 ;		//the lines below were copied by the last defrag and not written since.
+static nvmm_off_t checkpoint = 0 ;	//lines written between two index checkpoints, 0 for the index of the defrag only.
+static nvmm_off_t unindexed = 0 ;	//lines written since the last index line.
+
+/*
+ * a value longer than a line is chunked into fragment lines of fragment_len bytes, 
+ * and the last piece as the line committing them.
+ * the fragments are written right below the line and copied together with it in a defrag.
+ */
+static nvmm_off_t fragment_len = NVMM_LINE_MAXLENGTH - sizeof(uint32_t) ;
+
+/*
+ * streaming write, one value at a time.
+ * the lines are reserved at ctindex on open and ctindex moves over them on close.
+ */
+typedef struct{
+	uint8_t opened ;
+	uint16_t id ;
+	nvmm_off_t offset ;		//offset of the 1st line.
+	nvmm_off_t fragments ;	//fragment lines before the last line, 0 if the value fits in one line.
+	size_t datlen ;			//length declared on open.
+	size_t written ;			//bytes appended so far, the ones not filling a program unit yet are in tail.
+	uint8_t tail[NVMM_PROGRAM_UNIT_MAX] ;
+	uint8_t compressed ;		//the value is compressed by g_write_nvmm.
+	uint8_t group ;			//the page group the value is written in.
+}nvmm_stream_t ;
+
+static nvmm_stream_t stream = {0} ;
+
+static uint32_t generation = 0 ;	//counts the defrags, lines only move in a defrag.
+
+static compress_nvmm_t compress_level = 0 ;	//compression level of an id, 0 for no compression at all.
+static uint8_t dedup = 0 ;		//a value already held by a line is written as a reference to it.
+static checksum_nvmm_t checksum = 0 ;	//checksum of the values and the retained state, 0 for crc_value.
+static uint8_t* bloom = 0 ;		//bloom filter of the ids written in both groups, 0 for no filter.
+static size_t bloom_bits = 0 ;
+static nvmm_cache_t* cache = 0 ;		//values of the items read lately, 0 for no cache.
+static size_t cache_num = 0 ;
+static uint32_t cache_clock = 0 ;	//counts the hits and the entries kept, for the least recently used one.
+static uint32_t cache_hits = 0 ;
+static uint32_t cache_misses = 0 ;
+static uint8_t* shadow = 0 ;		//RAM mirror of the active page of the hot group, 0 for no mirror.
+static size_t shadow_size = 0 ;
+static uint16_t shadow_page = 0xFFFF ;	//the page mirrored, 0xFFFF before it's filled.
+static read_nvbytes_t shadow_fill = 0 ;	//fills the mirror, 0 for read_nvbytes.
+static uint8_t* scan = 0 ;		//readahead window of the header scans, 0 for reading every header alone.
+static size_t scan_size = 0 ;
+static uint32_t scan_address = 0 ;	//flash address of the window.
+static size_t scan_len = 0 ;		//bytes in the window, 0 before it's filled.
+
+/*
+ * page groups, every group is a pair of pages with a ping- pong of its own.
+ * the group in use is in the statics above, the other one is parked here.
+ */
+typedef struct{
+	uint16_t page_a_id ;
+	uint16_t page_b_id ;
+	uint16_t activedpage ;
+	nvmm_off_t ctindex ;
+	nvmm_off_t settled ;
+	uint8_t tail_dirty ;
+	uint8_t format ;
+	uint32_t erases ;
+	uint32_t spare_erases ;
+	uint32_t mount_defrags ;
+	uint32_t mount_written ;
+	nvmm_off_t unindexed ;
+}nvmm_group_t ;
+
+static nvmm_group_t groups[NVMM_GROUP_NUM] ;
+
+/*
+ * the mount state kept in the retained RAM over a warm reset, in nvmm_retain_t.state.
+ * a group is not retained with activedpage 0xFFFF.
+ */
+typedef struct{
+	nvmm_off_t page_size ;
+	nvmm_off_t erase_size ;
+	nvmm_off_t program_page_size ;
+	uint16_t program_unit ;
+	uint8_t header_format ;
+	nvmm_group_t groups[NVMM_GROUP_NUM] ;
+}nvmm_retained_t ;
+
+typedef char nvmm_retained_fits_t[(sizeof(nvmm_retained_t) <= sizeof(((nvmm_retain_t* )0)->state))? 1 : -1] ;
+
+static nvmm_retain_t* retain = 0 ;	//the retained RAM, 0 for mounting from the flash every time.
+static uint8_t group = NVMM_GROUP_HOT ;
+static uint8_t cold_mounted = 0 ;
+static classify_nvmm_t classify = 0 ;
+static uint8_t moving = 0 ;		//the defrag of the hot group moves the settled items to the cold group.
+
+/*
+ * decompressing state, the compressed bytes are read ahead and the last decompressed bytes are kept for matches.
+ */
+typedef struct{
+	nvmm_cursor_t raw ;		//compressed bytes left.
+	uint8_t in[NVMM_IO_BUFFER_SIZE] ;
+	size_t in_pos ;
+	size_t in_len ;
+	uint8_t window[NVMM_COMPRESS_WINDOW] ;
+}nvmm_decompress_t ;
+
+static int read_line(uint16_t pageid, nvmm_off_t offset, nvmm_line_t* line) ;
+static void write_data(uint16_t pageid, nvmm_off_t offset, uint8_t* dat, size_t datlen) ;
+static void begin_line(uint16_t pageid, nvmm_off_t offset, nvmm_off_t len) ;
+static void commit_line(uint16_t pageid, nvmm_off_t offset, uint16_t lineid, nvmm_off_t len, uint32_t delimiter) ;
+static void write_inline_line(uint16_t pageid, nvmm_off_t offset, uint16_t lineid, uint8_t* dat, nvmm_off_t len) ;
+static nvmm_off_t copy_references(uint16_t src_pageid, uint16_t tgt_pageid, nvmm_off_t offset_tgt, uint8_t format) ;
+static int open_line_cursor(nvmm_cursor_t* cursor, const nvmm_line_t* line, size_t offset, uint8_t follow) ;
+static void cache_drop(uint16_t id) ;
+static int flush_programs(void) ;
+static uint32_t hash_value(const uint8_t* dat, size_t len) ;
+static void dummy_activedpage(void) ;
+static int defrag_page(uint16_t src_pageid) ;
+
+
+/*
+ * read len bytes at a flash address, from the shadow if it's in the page mirrored, 
+ * or from the readahead window if they are in it.
+ */
+static void read_address(uint32_t address, uint8_t* buf, size_t len)
 {
-	uint16_t index ;
-	uint32_t delimiter ;
-	
-  
-	for(index=page_size-sizeof(uint32_t);index>sizeof(nvmm_pageheader_t);index-=sizeof(uint32_t))
+	uint32_t base = FLASH_ADDRESS(shadow_page, 0) ;
+
+	if(shadow_page != 0xFFFF && address >= base && address + len <= base + page_size)
 	{
-		if(index == 8)
-		{
-			index = index ;
-		}
-		(* read_nvbytes)(FLASH_ADDRESS(activedpage, index), (uint8_t* )(&delimiter), \
-						sizeof(uint32_t), sizeof(uint32_t)) ;
-		if(IS_LINEDELIMITER_LEGAL(delimiter))
-		{
-			break;
-		}
+		memcpy(buf, shadow + (address - base), len) ;
+		return ;
 	}
-	ctindex = index + sizeof(uint32_t) ;
+	if(scan_len != 0 && address >= scan_address && address + len <= scan_address + scan_len)
+	{
+		memcpy(buf, scan + (address - scan_address), len) ;
+		return ;
+	}
+
+	flush_programs() ;
+	(* read_nvbytes)(address, buf, len, len) ;
 }
 
 
+static void read_flash(uint16_t pageid, nvmm_off_t offset, uint8_t* buf, size_t len)
+{
+	read_address(FLASH_ADDRESS(pageid, offset), buf, len) ;
+}
+
 
 /*
- *
+ * read len bytes at offset on the way down a page, headers are walked from the top.
+ * bytes not in the readahead window refill it with the window size of bytes ending at them,
+ * so the headers and values below are read by the same flash read.
  */
-static int erase_page(uint16_t pageid)
-{	
-	uint8_t tmp ;
-	uint16_t offset ;
-	
-	(* erase_nvpage)(FLASH_ADDRESS(pageid, 0));
-	
-	//check erase operation.
-	for(offset=0;offset<page_size;offset++)
+static void scan_flash(uint16_t pageid, nvmm_off_t offset, uint8_t* buf, size_t len)
+{
+	uint32_t address = FLASH_ADDRESS(pageid, offset) ;
+	size_t end = (size_t)offset + len ;
+	size_t start ;
+
+	if(scan != 0 && len <= scan_size && pageid != shadow_page && \
+		(scan_len == 0 || address < scan_address || address + len > scan_address + scan_len))
 	{
-		(* read_nvbytes)(FLASH_ADDRESS(pageid, offset), &tmp, sizeof(uint8_t), sizeof(uint8_t));
-		if (tmp != 0xff)
+		start = (end > scan_size)? end - scan_size : 0 ;
+		scan_len = 0 ;
+		flush_programs() ;
+		if((* read_nvbytes)(FLASH_ADDRESS(pageid, start), scan, scan_size, end - start) == 0)
 		{
-			return -1 ;
+			scan_address = FLASH_ADDRESS(pageid, start) ;
+			scan_len = end - start ;
 		}
 	}
-	
-	
-	
-	return 0 ;
+
+	read_address(address, buf, len) ;
 }
 
 
 /*
- *
+ * mirror a page in the shadow, the page is read from RAM until it's erased.
  */
-static void clean_page(uint8_t pageid)
+static void shadow_load(uint16_t pageid)
 {
-	uint8_t tmp ;
-	uint16_t offset ;
+	read_nvbytes_t fill = (shadow_fill != 0)? shadow_fill : read_nvbytes ;
 
-	for(offset=0;offset<page_size;offset++)
+	shadow_page = 0xFFFF ;
+	if(shadow == 0 || shadow_size < page_size)
 	{
-		(* read_nvbytes)(FLASH_ADDRESS(pageid, offset), &tmp, sizeof(uint8_t), sizeof(uint8_t));
-		if (tmp != 0xff)
-		{
-			erase_page(pageid) ;
-			return ;
-		}
+		return ;
+	}
+	flush_programs() ;
+
+	if((* fill)(FLASH_ADDRESS(pageid, 0), shadow, shadow_size, page_size) == 0)
+	{
+		shadow_page = pageid ;
 	}
 }
 
+
 /*
- *
+ * program num units at a flash address, collected for the vectored write while a line is being written.
  */
-static int verify_words(uint16_t pageid, uint16_t offset, uint8_t* reference, size_t len)
+static void program_units(uint32_t address, uint8_t* words, size_t num)
 {
-	uint8_t tmp[4] ;
+	size_t len = num * program_unit ;
 
-	while(len--)
+	if(!collecting || len > sizeof(pending_data))
 	{
-		(* read_nvbytes)(FLASH_ADDRESS(pageid, offset), tmp, sizeof(tmp), sizeof(tmp)) ;
-		if (0 != memcmp(tmp, reference, sizeof(tmp)))
-		{
-			return -1 ;
-		}
-		offset += sizeof(tmp) ;
-		reference += sizeof(tmp) ;
+		flush_programs() ;
+		(* write_nvwords)(address, words, num) ;
+		return ;
 	}
-	
-	return 0 ;
+
+	if(pending_num == NVMM_VECTOR_SEGMENTS || pending_used + len > sizeof(pending_data))
+	{
+		flush_programs() ;
+	}
+	memcpy(pending_data + pending_used, words, len) ;
+	pending[pending_num].address = address ;
+	pending[pending_num].buf = pending_data + pending_used ;
+	pending[pending_num].len = len ;
+	pending_num++ ;
+	pending_used += len ;
 }
 
 
 /*
- *
+ * hand the programs collected to the vectored write, and read them back.
+ * a unit programmed twice in the call reads back with the bits of both, so only the bits each program clears are checked.
+ * will return 0 for success, -1 if a program didn't take.
  */
-static void write_word(uint16_t pageid, uint16_t offset, uint8_t* word)
+static int flush_programs(void)
 {
-	(* write_nvwords)(FLASH_ADDRESS(pageid, offset), word, 1) ;
-	verify_words(pageid, offset, word, 1) ;
-}
-
+	nvmm_segment_t back[NVMM_VECTOR_SEGMENTS] ;
+	uint8_t tmp[NVMM_VECTOR_SIZE] ;
+	size_t num = pending_num ;
+	size_t used = pending_used ;
+	size_t i ;
 
-static void write_words(uint16_t pageid, uint16_t offset, uint8_t* words, size_t count)
-{
-	(* write_nvwords)(FLASH_ADDRESS(pageid, offset), words, count) ;
-	verify_words(pageid, offset, words, count) ;
-}
+	if(num == 0)
+	{
+		return 0 ;
+	}
+	pending_num = 0 ;
+	pending_used = 0 ;
 
+	(* writev_nvwords)(pending, num) ;
 
+	for(i=0;i<num;i++)
+	{
+		back[i].address = pending[i].address ;
+		back[i].buf = tmp + (pending[i].buf - pending_data) ;
+		back[i].len = pending[i].len ;
+	}
+	if(readv_nvbytes != 0)
+	{
+		(* readv_nvbytes)(back, num) ;
+	}
+	else
+	{
+		for(i=0;i<num;i++)
+		{
+			(* read_nvbytes)(back[i].address, back[i].buf, back[i].len, back[i].len) ;
+		}
+	}
 
-static void active_page(uint16_t pageid)
-{
-	nvmm_pageheader_t header ;
+	for(i=0;i<used;i++)
+	{
+		if(tmp[i] & ~pending_data[i])
+		{
+			return -1 ;
+		}
+	}
 
-	header.state = NVMM_ACTIVE_PAGE_STATE ;
-	header.dummy.id = 0xCAFE ;
-	header.dummy.delimiter = NVMM_LINE_DELIMITER ;
-	write_words( pageid, 0, (uint8_t* )(&header), PAD_LENGTH(sizeof(nvmm_pageheader_t)) / sizeof(uint32_t)) ;
-	activedpage = pageid ;
+	return 0 ;
 }
 
+
 /*
- *
+ * program count program units, split on program page boundaries since external flash 
+ * wraps around inside the program page instead of going on to the next one.
  */
-static uint16_t find_line_address(uint16_t pageid, uint16_t offset, uint16_t lineid)
+static void program_words(uint16_t pageid, nvmm_off_t offset, uint8_t* words, size_t count)
 {
-	nvmm_lineheader_t lheader ;
-	
-	offset -= sizeof(nvmm_lineheader_t) ;
+	uint32_t address = FLASH_ADDRESS(pageid, offset) ;
+	size_t room ;
+	size_t num ;
+	size_t i ;
 
-	while(offset >= sizeof(nvmm_pageheader_t))
-	{
-		(* read_nvbytes)(FLASH_ADDRESS(pageid, offset), (uint8_t *)(&lheader), \
-						sizeof(nvmm_lineheader_t), sizeof(nvmm_lineheader_t));
+	if(retain != 0)
+	{//the state retained is out of date from now on.
+		retain->mark = 0 ;
+	}
 
-		if (lheader.id == lineid)
-		{//found.
-			return offset - lheader.len ;
-		}
-		else if (!IS_LINELENGTH_LEGAL(lheader.len))
-		{
-			offset -= sizeof(nvmm_lineheader_t) ;
-		}
-		else
+	while(count > 0)
+	{
+		num = count ;
+		if(program_page_size != 0)
 		{
-			if (lheader.len + sizeof(nvmm_lineheader_t) <= offset)
+			room = (program_page_size - address % program_page_size) / program_unit ;
+			if(num > room)
 			{
-				offset -= lheader.len + sizeof(nvmm_lineheader_t) ;
+				num = room ;
 			}
-			else
+		}
+
+		program_units(address, words, num) ;
+		if(scan_len != 0 && address < scan_address + scan_len && address + num * program_unit > scan_address)
+		{
+			scan_len = 0 ;
+		}
+		if(shadow_page != 0xFFFF && address >= FLASH_ADDRESS(shadow_page, 0) && \
+			address < FLASH_ADDRESS(shadow_page, page_size))
+		{//programming clears bits only, the same in the shadow.
+			for(i=0;i<num*program_unit;i++)
 			{
-				/*
-				 * The content is incorrect, might be hardware fault.
-				 * need to re- initialize current page here or use assert to mention.
-				 *
-				 */
-				return 0 ;	
+				shadow[address - FLASH_ADDRESS(shadow_page, 0) + i] &= words[i] ;
 			}
 		}
+
+		address += num * program_unit ;
+		words += num * program_unit ;
+		count -= num ;
 	}
-	
-	
-	return 0;
 }
 
-static void copy_line(uint16_t pageid, uint16_t offset_tgt, size_t len, uint16_t offset_src)
+
+/*
+ * the compact line header has no delimiter to search for, but its length goes before the data,
+ * so the highest programmed word is always a line header, and the lines are walked down from it
+ * to the last committed one.
+ */
+static void locate_compact_ctindex(void)
 {
-	uint8_t tmp[4] ;
-	size_t i = 0 ;
+	nvmm_off_t index ;
+	nvmm_off_t top ;
+	nvmm_line_t line ;
+	uint32_t word ;
 
-	// Copy over the data
-	while (i < len)
+	for(index=page_size-header_slot;index>=page_base;index-=header_slot)
 	{
-		(* read_nvbytes)(FLASH_ADDRESS(activedpage, offset_src + i), tmp, sizeof(tmp), sizeof(tmp)) ;
-		write_word(pageid, offset_tgt + i, tmp);
-
-		i += sizeof(tmp);
+		scan_flash(activedpage, index, (uint8_t* )(&word), sizeof(uint32_t)) ;
+		if(word != 0xFFFFFFFF)
+		{
+			break ;
+		}
 	}
-}
-
-static int defrag_page(uint16_t src_pageid)
-{
-	uint16_t offset_src ;
-	uint16_t offset_tgt ;
-	uint16_t tgt_pageid ;//target page id.
-	nvmm_lineheader_t lheader ;
-	uint16_t lineid_tmp = 0xFFFF ;//history line id.
+	top = index ;
 
-	tgt_pageid = (src_pageid == page_a_id)? page_b_id : page_a_id ;
+	while(index >= page_base)
+	{
+		if(read_line(activedpage, index, &line) != 0)
+		{//broken content, nothing to keep.
+			index = page_base - header_slot ;
+			break ;
+		}
+		if((IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter)) || IS_INDEX_DELIMITER(line.delimiter))
+		{
+			break ;
+		}
+		index = line.bottom - header_slot ;
+	}
+	ctindex = index + header_slot ;
 
-	offset_tgt = sizeof(nvmm_pageheader_t) ;
+	//a line was being written when powered off.
+	tail_dirty = (top >= ctindex) ;
+}
 
-	offset_src = ctindex - sizeof(nvmm_lineheader_t) ;
 
-  	while(offset_src >= sizeof(nvmm_pageheader_t))
+static void locate_ctindex(void)
+{
+	nvmm_off_t index ;
+	nvmm_off_t lowest ;
+	nvmm_off_t dirty = 0 ;
+	uint32_t delimiter ;
+	
+	if(compact)
+	{
+		locate_compact_ctindex() ;
+		return ;
+	}
+	
+	//the dummy line delimiter is the lowest one to find.
+	lowest = page_base - header_slot + offsetof(nvmm_lineheader_t, delimiter) ;
+  
+	for(index=page_size-sizeof(uint32_t);index>lowest;index-=sizeof(uint32_t))
 	{
-		(* read_nvbytes)(FLASH_ADDRESS(src_pageid, offset_src), (uint8_t* )(&lheader), \
-					sizeof(nvmm_lineheader_t), sizeof(nvmm_lineheader_t));
-		if(!IS_LINEID_LEGAL(lheader.id) || !(IS_LINEDELIMITER_LEGAL(lheader.delimiter)))
+		scan_flash(activedpage, index, (uint8_t* )(&delimiter), sizeof(uint32_t)) ;
+		if((IS_LINEDELIMITER_LEGAL(delimiter) || IS_INDEX_DELIMITER(delimiter)) && \
+			(index - offsetof(nvmm_lineheader_t, delimiter) + header_slot) % line_align == 0)
 		{
-			 if(!IS_LINELENGTH_LEGAL(lheader.len))
-			 {
-				offset_src -= sizeof(nvmm_lineheader_t) ;
-			 }
-			 else
-			 {
-				if(lheader.len + sizeof(nvmm_lineheader_t) <= offset_src)
-				{
-					offset_src -= lheader.len + sizeof(nvmm_lineheader_t) ;
-				}
-				else
-				{
-					/*
-					 * The content is incorrect, might be hardware fault.
-					 * need to re- initialize current page here or use assert to mention.
-					 *
-					 */
-					return -1 ;	
-				}
-			 }
-
-			 continue;
+			break;
 		}
+		if(delimiter != 0xFFFFFFFF && dirty == 0)
+		{//the highest programmed word.
+			dirty = index ;
+		}
+	}
+	ctindex = index - offsetof(nvmm_lineheader_t, delimiter) + header_slot ;
 
-		if(IS_LINEID_LEGAL(lheader.id) && lheader.id != lineid_tmp)
+	/*
+	 * inline lines have a weaker mark than the line delimiter, so they aren't searched for in the data above,
+	 * they are only taken right behind the last line, one after another.
+	 */
+	while(ctindex + header_slot <= page_size)
+	{
+		read_flash(activedpage, ctindex + offsetof(nvmm_lineheader_t, delimiter), (uint8_t* )(&delimiter), \
+			sizeof(uint32_t)) ;
+		if(!IS_INLINE_DELIMITER(delimiter))
 		{
-			lineid_tmp = lheader.id ;
-
-			if (find_line_address(tgt_pageid, offset_tgt, lineid_tmp) == 0)
-			{//no exist line found. create a new one.
-				copy_line(tgt_pageid, offset_tgt, lheader.len + sizeof(nvmm_lineheader_t), offset_src - lheader.len);
-
-				offset_tgt += lheader.len + sizeof(nvmm_lineheader_t) ;
-			}	
+			break ;
 		}
-		
-		offset_src -= lheader.len + sizeof(nvmm_lineheader_t) ;
+		ctindex += header_slot ;
 	}
 
-
-	//active target page.
-	active_page(tgt_pageid) ;
-
-	ctindex = offset_tgt ;
-
-	erase_page(src_pageid) ;
-	
-	
-	return 0 ;
+	//a line was being written when powered off.
+	tail_dirty = (dirty >= ctindex) ;
 }
 
 
+
 /*
- * check current nvmm and see current status of nvmm.
- * will return 0 for success, -1 for something error.
- *
+ * check if the whole page is erased.
  */
-static int check_nvmm( void )
+static int is_page_blank(uint16_t pageid)
+{
+	uint8_t tmp[NVMM_IO_BUFFER_SIZE] ;
+	nvmm_off_t offset ;
+	size_t len ;
+	size_t i ;
+
+	for(offset=0;offset<page_size;offset+=len)
+	{
+		len = page_size - offset ;
+		if(len > sizeof(tmp))
+		{
+			len = sizeof(tmp) ;
+		}
+		read_flash(pageid, offset, tmp, len) ;
+		for(i=0;i<len;i++)
+		{
+			if (tmp[i] != 0xff)
+			{
+				return 0 ;
+			}
+		}
+	}
+
+	return 1 ;
+}
+
+
+/*
+ *
+ */
+static int erase_page(uint16_t pageid)
+{	
+	nvmm_off_t offset ;
+	
+	if(pageid == shadow_page)
+	{
+		shadow_page = 0xFFFF ;
+	}
+	scan_len = 0 ;
+	flush_programs() ;
+	if(retain != 0)
+	{
+		retain->mark = 0 ;
+	}
+
+	//a page might be made up of several erase units.
+	for(offset=0;offset<page_size;offset+=erase_size)
+	{
+		(* erase_nvpage)(FLASH_ADDRESS(pageid, offset));
+	}
+	
+	//check erase operation.
+	if(!is_page_blank(pageid))
+	{
+		return -1 ;
+	}
+	
+	
+	return 0 ;
+}
+
+
+/*
+ *
+ */
+static uint8_t clean_page(uint8_t pageid)
+{
+	if(!is_page_blank(pageid))
+	{
+		erase_page(pageid) ;
+
+		return 1 ;
+	}
+
+	return 0 ;
+}
+
+/*
+ *
+ */
+static int verify_words(uint16_t pageid, nvmm_off_t offset, uint8_t* reference, size_t len)
+{
+	uint8_t tmp[NVMM_IO_BUFFER_SIZE] ;
+	size_t num ;
+
+	flush_programs() ;
+	while(len > 0)
+	{
+		num = (len < sizeof(tmp))? len : sizeof(tmp) ;
+		(* read_nvbytes)(FLASH_ADDRESS(pageid, offset), tmp, num, num) ;	//the flash itself, not the shadow.
+		if (0 != memcmp(tmp, reference, num))
+		{
+			return -1 ;
+		}
+		offset += num ;
+		reference += num ;
+		len -= num ;
+	}
+	
+	return 0 ;
+}
+
+
+/*
+ * program and verify len bytes, len is a multiple of the program unit.
+ */
+static void write_words(uint16_t pageid, nvmm_off_t offset, uint8_t* words, size_t len)
+{
+	program_words(pageid, offset, words, len / program_unit) ;
+	if(!collecting)
+	{//the programs collected are read back together.
+		verify_words(pageid, offset, words, len) ;
+	}
+}
+
+
+/*
+ * program the units that differ between 2stages of a staged line header of size bytes.
+ */
+static void write_header_stage(uint16_t pageid, nvmm_off_t offset, const void* header, const void* last, size_t size)
+{
+	const uint8_t* now = (const uint8_t* )header ;
+	const uint8_t* before = (const uint8_t* )last ;
+	uint16_t start ;
+	uint16_t end ;
+
+	for(start=0;start<size;start=end)
+	{
+		if(memcmp(now + start, before + start, program_unit) == 0)
+		{
+			end = start + program_unit ;
+			continue ;
+		}
+		for(end=start+program_unit;end<size;end+=program_unit)
+		{
+			if(memcmp(now + end, before + end, program_unit) == 0)
+			{
+				break ;
+			}
+		}
+		write_words(pageid, offset + start, (uint8_t* )now + start, end - start) ;
+	}
+}
+
+
+
+static void active_page(uint16_t pageid)
 {
 	nvmm_pageheader_t header ;
-	uint16_t dummypage = NVMM_PAGE_NULL ;
+	nvmm_wear_record_t wear ;
+	uint8_t slot[NVMM_PROGRAM_UNIT_MAX] ;
 
-	activedpage = NVMM_PAGE_NULL;
+	memset(&header, 0xFF, sizeof(nvmm_pageheader_t)) ;
+	header.state = NVMM_ACTIVE_PAGE_STATE ;
+	header.dummy.id = 0xCAFE ;
+	header.dummy.len = 0 ;
+	header.dummy.delimiter = NVMM_LINE_DELIMITER ;
+	if(wear_record)
+	{//the erase counts go with the activation.
+		wear.mark = compact? NVMM_COMPACT_WEAR_PAGE_MARK : NVMM_WEAR_PAGE_MARK ;
+		wear.erases = erases ;
+		wear.spare_erases = spare_erases ;
+		memset(slot, 0xFF, sizeof(slot)) ;
+		memcpy(slot, &wear, sizeof(nvmm_wear_record_t)) ;
+		write_words(pageid, WEAR_OFFSET(), slot, WEAR_SPAN()) ;
+	}
+	if(compact)
+	{//the mark first, the state activates the page at last.
+		if(!wear_record)
+		{
+			header.state = NVMM_COMPACT_PAGE_MARK ;
+			write_words(pageid, sizeof(uint32_t), (uint8_t* )(&header.state), sizeof(uint32_t)) ;
+		}
+		header.state = NVMM_ACTIVE_PAGE_STATE ;
+		write_words(pageid, 0, (uint8_t* )(&header.state), sizeof(uint32_t)) ;
+	}
+	else if(IS_STAGED_COMMIT())
+	{//dummy line header first, the state activates the page at last.
+		write_words(pageid, page_base - header_slot, (uint8_t* )(&header.dummy), sizeof(nvmm_lineheader_t)) ;
+		write_words(pageid, 0, (uint8_t* )(&header.state), sizeof(uint32_t)) ;
+	}
+	else
+	{//dummy line header first, the state activates the page at last.
+		memset(slot, 0xFF, sizeof(slot)) ;
+		memcpy(slot, &header.dummy, sizeof(nvmm_lineheader_t)) ;
+		write_words(pageid, page_base - header_slot, slot, header_slot) ;
+
+		memset(slot, 0xFF, sizeof(slot)) ;
+		memcpy(slot, &header.state, sizeof(uint32_t)) ;
+		write_words(pageid, 0, slot, line_align) ;
+	}
+	activedpage = pageid ;
+}
 
-	//check page A.
-	(* read_nvbytes)(FLASH_ADDRESS(page_a_id, 0), (uint8_t* )(&header), \
-					sizeof(nvmm_pageheader_t), sizeof(nvmm_pageheader_t)) ;
-	if ( header.state == NVMM_ACTIVE_PAGE_STATE)
-	{//current page is used as actived page.
-		if(activedpage == NVMM_PAGE_NULL)
+
+/*
+ * load the erase counts from the wear record of the active page, a legacy page has none.
+ */
+static void read_wear(void)
+{
+	nvmm_wear_record_t wear ;
+
+	erases = 0 ;
+	spare_erases = 0 ;
+	if(wear_record)
+	{
+		read_flash(activedpage, WEAR_OFFSET(), (uint8_t* )(&wear), sizeof(nvmm_wear_record_t)) ;
+		erases = wear.erases ;
+		spare_erases = wear.spare_erases ;
+	}
+}
+
+
+/*
+ * get the page state, NVMM_ACTIVE_PAGE_STATE, NVMM_DUMMY_PAGE_STATE or others for an undefined page.
+ */
+static uint32_t read_page_state(uint16_t pageid)
+{
+	uint32_t state ;
+	uint32_t mark ;
+
+	read_flash(pageid, 0, (uint8_t* )(&state), sizeof(uint32_t)) ;
+	if(!IS_STAGED_COMMIT() && state == NVMM_ACTIVE_PAGE_STATE)
+	{
+		read_flash(pageid, line_align, (uint8_t* )(&mark), sizeof(uint32_t)) ;
+		if(mark == NVMM_DUMMY_PAGE_STATE)
 		{
-			activedpage = page_a_id ;
+			return NVMM_DUMMY_PAGE_STATE ;
+		}
+	}
+	else if(IS_STAGED_COMMIT() && state != NVMM_ACTIVE_PAGE_STATE && (state & NVMM_ACTIVE_PAGE_STATE) == state)
+	{//half word flash clears the state in 2programs, powered off in between.
+		return NVMM_DUMMY_PAGE_STATE ;
+	}
+
+	return state ;
+}
+
+/*
+ * get the line header format of a page from its page header.
+ */
+static uint8_t page_format(uint16_t pageid)
+{
+	uint32_t mark ;
+
+	read_flash(pageid, WEAR_OFFSET(), (uint8_t* )(&mark), sizeof(uint32_t)) ;
+	if(mark == NVMM_WEAR_PAGE_MARK)
+	{
+		return NVMM_HEADER_STANDARD ;
+	}
+	if(IS_STAGED_COMMIT() && mark == NVMM_COMPACT_WEAR_PAGE_MARK)
+	{
+		return NVMM_HEADER_COMPACT ;
+	}
+	if(IS_STAGED_COMMIT() && mark == NVMM_COMPACT_PAGE_MARK)
+	{
+		return NVMM_HEADER_COMPACT | NVMM_HEADER_LEGACY ;
+	}
+
+	return NVMM_HEADER_STANDARD | NVMM_HEADER_LEGACY ;
+}
+
+
+/*
+ * switch the line layout to the page in use.
+ */
+static void use_format(uint8_t format)
+{
+	compact = ((format & ~NVMM_HEADER_LEGACY) == NVMM_HEADER_COMPACT) ;
+	wear_record = !(format & NVMM_HEADER_LEGACY) ;
+	if(compact)
+	{//a line header word, the page header is the state and the mark, the mark starts the wear record.
+		header_slot = sizeof(uint32_t) ;
+		page_base = WEAR_OFFSET() + (wear_record? WEAR_SPAN() : sizeof(uint32_t)) ;
+		fragment_len = NVMM_COMPACT_MAXLENGTH - sizeof(uint32_t) ;
+		inline_offset = 0 ;
+		inline_max = 0 ;
+
+		return ;
+	}
+
+	header_slot = PAD_LENGTH(sizeof(nvmm_lineheader_t)) ;
+	fragment_len = NVMM_LINE_MAXLENGTH - line_align ;
+	//state(and dummy mark without staged commit), wear record and dummy line header.
+	page_base = WEAR_OFFSET() + (wear_record? WEAR_SPAN() : 0) + header_slot ;
+	if(header_slot - sizeof(nvmm_lineheader_t) > offsetof(nvmm_lineheader_t, delimiter))
+	{//a wide program unit leaves more room behind the header than in front of the delimiter.
+		inline_offset = sizeof(nvmm_lineheader_t) ;
+		inline_max = header_slot - inline_offset ;
+	}
+	else
+	{
+		inline_offset = 0 ;
+		inline_max = offsetof(nvmm_lineheader_t, delimiter) ;
+	}
+}
+
+
+/*
+ * park the state of the group in use.
+ */
+static void park_group(nvmm_group_t* parked)
+{
+	parked->page_a_id = page_a_id ;
+	parked->page_b_id = page_b_id ;
+	parked->activedpage = activedpage ;
+	parked->ctindex = ctindex ;
+	parked->settled = settled ;
+	parked->tail_dirty = tail_dirty ;
+	parked->format = FORMAT_IN_USE() ;
+	parked->erases = erases ;
+	parked->spare_erases = spare_erases ;
+	parked->mount_defrags = mount_defrags ;
+	parked->mount_written = mount_written ;
+	parked->unindexed = unindexed ;
+}
+
+
+/*
+ * take the state of a group parked.
+ */
+static void unpark_group(const nvmm_group_t* parked)
+{
+	page_a_id = parked->page_a_id ;
+	page_b_id = parked->page_b_id ;
+	activedpage = parked->activedpage ;
+	ctindex = parked->ctindex ;
+	settled = parked->settled ;
+	tail_dirty = parked->tail_dirty ;
+	erases = parked->erases ;
+	spare_erases = parked->spare_erases ;
+	mount_defrags = parked->mount_defrags ;
+	mount_written = parked->mount_written ;
+	unindexed = parked->unindexed ;
+	use_format(parked->format) ;
+}
+
+
+/*
+ * switch to a page group, the group in use is parked and the other one is taken out.
+ */
+static void use_group(uint8_t next)
+{
+	if(next == group)
+	{
+		return ;
+	}
+
+	park_group(&groups[group]) ;
+	group = next ;
+	unpark_group(&groups[group]) ;
+}
+
+
+/*
+ * get the group the items of id are written in.
+ */
+static uint8_t id_group(uint16_t id)
+{
+	if(cold_mounted && classify != 0 && (* classify)(id) == NVMM_CLASS_COLD)
+	{
+		return NVMM_GROUP_COLD ;
+	}
+
+	return NVMM_GROUP_HOT ;
+}
+
+
+/*
+ * read and decode the compact line header at offset.
+ * a line without the high half is not committed yet, it gets an illegal id.
+ * will return 0 for success, -1 if the line goes over the page base.
+ */
+static int read_compact_line(uint16_t pageid, nvmm_off_t offset, nvmm_line_t* line)
+{
+	uint16_t half[2] ;
+	uint16_t id ;
+	uint16_t len ;
+
+	scan_flash(pageid, offset, (uint8_t* )half, sizeof(half)) ;
+
+	len = half[0] & 0xFFF ;
+	id = half[1] & 0xFFF ;
+	line->id = 0xFFFF ;
+	line->delimiter = 0xFFFFFFFF ;
+	line->compressed = 0 ;
+	if(half[0] != COMPACT_LOW(len) || len > fragment_len)
+	{//nothing to tell about the data, just step over the header slot.
+		line->len = 0 ;
+		line->data = offset ;
+		line->bottom = offset ;
+
+		return 0 ;
+	}
+	if(PAD_LENGTH(len) + page_base > offset)
+	{//broken content.
+		return -1 ;
+	}
+
+	if(id < NVMM_COMPACT_MAXID && half[1] == COMPACT_HIGH(id, len, NVMM_LINE_DELIMITER))
+	{
+		line->id = id ;
+		line->delimiter = NVMM_LINE_DELIMITER ;
+	}
+	else if(id < NVMM_COMPACT_MAXID && half[1] == COMPACT_HIGH(id, len, NVMM_FRAGMENT_DELIMITER))
+	{
+		line->id = id ;
+		line->delimiter = NVMM_FRAGMENT_DELIMITER ;
+	}
+	else if(id < NVMM_COMPACT_MAXID && half[1] == COMPACT_HIGH(id | NVMM_COMPRESSED_FLAG, len, NVMM_LINE_DELIMITER))
+	{
+		line->id = id ;
+		line->delimiter = NVMM_LINE_DELIMITER ;
+		line->compressed = 1 ;
+	}
+	else if(half[1] == COMPACT_HIGH(NVMM_INDEX_ID, len, NVMM_INDEX_DELIMITER))
+	{
+		line->id = NVMM_INDEX_ID ;
+		line->delimiter = NVMM_INDEX_DELIMITER ;
+	}
+	line->len = len ;
+	line->data = offset - PAD_LENGTH(len) ;
+	line->bottom = line->data ;
+
+	return 0 ;
+}
+
+
+/*
+ * read and decode the line header slot at offset.
+ * will return 0 for success, -1 if the line goes over the page base.
+ */
+static int read_line(uint16_t pageid, nvmm_off_t offset, nvmm_line_t* line)
+{
+	nvmm_lineheader_t lheader ;
+
+	if(compact)
+	{
+		return read_compact_line(pageid, offset, line) ;
+	}
+
+	scan_flash(pageid, offset, (uint8_t *)(&lheader), sizeof(nvmm_lineheader_t)) ;
+
+	if(IS_INLINE_DELIMITER(lheader.delimiter))
+	{
+		line->id = INLINE_ID(lheader.delimiter) ;
+		line->len = INLINE_LENGTH(lheader.delimiter) ;
+		line->data = offset + inline_offset ;
+		line->bottom = offset ;
+		line->delimiter = NVMM_LINE_DELIMITER ;
+		line->compressed = 0 ;
+
+		return 0 ;
+	}
+
+	line->id = lheader.id ;
+	line->delimiter = lheader.delimiter ;
+	line->compressed = 0 ;
+	if(lheader.delimiter == NVMM_LINE_DELIMITER && lheader.id != 0xFFFF && (lheader.id & NVMM_COMPRESSED_FLAG))
+	{
+		line->id = lheader.id & ~NVMM_COMPRESSED_FLAG ;
+		line->compressed = 1 ;
+	}
+	if (!IS_LINELENGTH_LEGAL(lheader.len))
+	{//nothing to tell about the data, just step over the header slot.
+		line->len = 0 ;
+		line->data = offset ;
+		line->bottom = offset ;
+	}
+	else if (PAD_LENGTH(lheader.len) + page_base <= offset)
+	{
+		line->len = lheader.len ;
+		line->data = offset - PAD_LENGTH(lheader.len) ;
+		line->bottom = line->data ;
+	}
+	else
+	{
+		/*
+		 * The content is incorrect, might be hardware fault.
+		 * need to re- initialize current page here or use assert to mention.
+		 *
+		 */
+		return -1 ;	
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * find the first entry of an index line whose id is not less than lineid, a binary search over the entries sorted by id.
+ * will return the entry number, the number of entries if all of them are less.
+ */
+static nvmm_off_t seek_index(uint16_t pageid, const nvmm_line_t* index, uint32_t lineid)
+{
+	nvmm_index_t entry ;
+	nvmm_off_t low = 0 ;
+	nvmm_off_t high = index->len / sizeof(nvmm_index_t) ;
+	nvmm_off_t mid ;
+
+	while(low < high)
+	{
+		mid = low + (high - low) / 2 ;
+		read_flash(pageid, index->data + mid * sizeof(nvmm_index_t), (uint8_t* )(&entry), sizeof(nvmm_index_t)) ;
+		if(entry.id < lineid)
+		{
+			low = mid + 1 ;
+		}
+		else
+		{
+			high = mid ;
 		}
 	}
-	else if(header.state == NVMM_DUMMY_PAGE_STATE)
-	{//current page is used as dummy page.
-		dummypage = page_a_id ;
+
+	return low ;
+}
+
+/*
+ * look lineid up in an index line.
+ * will return the line data offset and give the line to line, 0 for not in the index.
+ */
+static nvmm_off_t search_index(uint16_t pageid, const nvmm_line_t* index, uint16_t lineid, nvmm_line_t* line)
+{
+	nvmm_index_t entry ;
+	nvmm_off_t i ;
+
+	i = seek_index(pageid, index, lineid) ;
+	if(i >= index->len / sizeof(nvmm_index_t))
+	{
+		return 0 ;
+	}
+	read_flash(pageid, index->data + i * sizeof(nvmm_index_t), (uint8_t* )(&entry), sizeof(nvmm_index_t)) ;
+	if(entry.id != lineid)
+	{
+		return 0 ;
+	}
+	if(entry.slot < page_base || entry.slot >= index->bottom || read_line(pageid, entry.slot, line) != 0 || \
+		line->id != lineid || line->delimiter != NVMM_LINE_DELIMITER)
+	{//broken content.
+		return 0 ;
+	}
+
+	return line->data ;
+}
+
+/*
+ * find the latest line of lineid below offset.
+ * will return the line data offset and give the line to line if it's not 0, 0 for not found.
+ */
+static nvmm_off_t find_line_address(uint16_t pageid, nvmm_off_t offset, uint16_t lineid, nvmm_line_t* line)
+{
+	nvmm_line_t tmp ;
+	nvmm_line_t index ;
+
+	if(line == 0)
+	{
+		line = &tmp ;
+	}
+	
+	offset -= header_slot ;
+
+	while(offset >= page_base)
+	{
+		if(read_line(pageid, offset, line) != 0)
+		{
+			return 0 ;
+		}
+
+		if (line->id == lineid && line->delimiter == NVMM_LINE_DELIMITER)
+		{//found.
+			return line->data ;
+		}
+		if(IS_INDEX_DELIMITER(line->delimiter))
+		{//the lines below are all in the index.
+			index = *line ;
+			return search_index(pageid, &index, lineid, line) ;
+		}
+
+		offset = line->bottom - header_slot ;
+	}
+	
+	
+	return 0;
+}
+
+/*
+ * set or test the bloom filter bits of id.
+ * will return 1 if id might be written, 0 if it never was.
+ */
+static uint8_t bloom_id(uint16_t id, uint8_t add)
+{
+	uint32_t hash = (uint32_t)id * 0x9E3779B1 ;
+	uint32_t step = (hash >> 16) | 1 ;
+	uint32_t bit ;
+	uint8_t i ;
+
+	if(bloom == 0)
+	{
+		return 1 ;
+	}
+
+	for(i=0;i<NVMM_BLOOM_HASHES;i++)
+	{
+		bit = (hash + i * step) % bloom_bits ;
+		if(add)
+		{
+			bloom[bit >> 3] |= 1 << (bit & 7) ;
+		}
+		else if(!(bloom[bit >> 3] & (1 << (bit & 7))))
+		{
+			return 0 ;
+		}
+	}
+
+	return 1 ;
+}
+
+/*
+ * add the ids of the group in use to the bloom filter.
+ * the lines are walked down to the index line, the ids below are taken from its entries.
+ */
+static void bloom_lines(void)
+{
+	nvmm_index_t entry ;
+	nvmm_line_t line ;
+	nvmm_off_t offset ;
+	nvmm_off_t i ;
+
+	for(offset=ctindex-header_slot;offset>=page_base;offset=line.bottom-header_slot)
+	{
+		if(read_line(activedpage, offset, &line) != 0)
+		{
+			return ;
+		}
+		if(IS_INDEX_DELIMITER(line.delimiter))
+		{
+			for(i=0;i<line.len/sizeof(nvmm_index_t);i++)
+			{
+				read_flash(activedpage, line.data + i * sizeof(nvmm_index_t), (uint8_t* )(&entry), sizeof(nvmm_index_t)) ;
+				if(IS_LINEID_LEGAL(entry.id))
+				{
+					bloom_id(entry.id, 1) ;
+				}
+			}
+			return ;
+		}
+		if(IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter))
+		{
+			bloom_id(line.id, 1) ;
+		}
+	}
+}
+
+/*
+ * build the bloom filter from the groups mounted.
+ */
+static void bloom_build(void)
+{
+	if(bloom == 0)
+	{
+		return ;
+	}
+
+	memset(bloom, 0, (bloom_bits + 7) / 8) ;
+	bloom_lines() ;
+	if(cold_mounted)
+	{
+		use_group(NVMM_GROUP_COLD) ;
+		bloom_lines() ;
+		use_group(NVMM_GROUP_HOT) ;
+	}
+}
+
+/*
+ * count the fragments right below the line of lineid whose lowest offset is bottom,
+ * and give their length to len.
+ */
+static nvmm_off_t count_fragments(uint16_t pageid, nvmm_off_t bottom, uint16_t lineid, nvmm_off_t* len)
+{
+	nvmm_line_t line ;
+	nvmm_off_t count = 0 ;
+
+	*len = 0 ;
+	while(bottom >= page_base + header_slot)
+	{
+		if(read_line(pageid, bottom - header_slot, &line) != 0 || \
+			line.id != lineid || line.delimiter != NVMM_FRAGMENT_DELIMITER || \
+			line.len % line_align != 0 || (count > 0 && line.len != *len))
+		{
+			break ;
+		}
+		*len = line.len ;
+		bottom = line.bottom ;
+		count++ ;
+	}
+
+	return count ;
+}
+
+static void copy_line(uint16_t pageid, nvmm_off_t offset_tgt, size_t len, nvmm_off_t offset_src)
+{
+	uint8_t tmp[NVMM_IO_BUFFER_SIZE] ;
+	uint32_t address ;
+	size_t num ;
+	size_t i = 0 ;
+
+	// Copy over the data, batched so every program ends on a program page boundary.
+	while (i < len)
+	{
+		num = (len - i < sizeof(tmp))? len - i : sizeof(tmp) ;
+		if(program_page_size != 0)
+		{
+			address = FLASH_ADDRESS(pageid, offset_tgt + i) ;
+			if(num > program_page_size - address % program_page_size)
+			{
+				num = program_page_size - address % program_page_size ;
+			}
+		}
+
+		read_flash(activedpage, offset_src + i, tmp, num) ;
+		write_words(pageid, offset_tgt + i, tmp, num);
+
+		i += num;
+	}
+}
+
+/*
+ * check if line is the latest line of its id.
+ */
+static int is_line_live(uint16_t pageid, const nvmm_line_t* line)
+{
+	return find_line_address(pageid, ctindex, line->id, 0) == line->data ;
+}
+
+
+/*
+ * read the reference line commits.
+ * will return 1 if the line is a reference, 0 if it holds a value.
+ */
+static int read_reference(uint16_t pageid, const nvmm_line_t* line, nvmm_reference_t* ref)
+{
+	nvmm_off_t len ;
+
+	if(!line->compressed || line->len != sizeof(nvmm_reference_t) || \
+		count_fragments(pageid, line->bottom, line->id, &len) != 0)
+	{//a reference is a single line of its own length, a compressed value of that length is told by the mark.
+		return 0 ;
+	}
+	read_flash(pageid, line->data, (uint8_t* )ref, sizeof(nvmm_reference_t)) ;
+
+	return (ref->size & NVMM_REFERENCE_MARK) != 0 ;
+}
+
+
+/*
+ * get the item line commits, with its fragments.
+ */
+static void get_item(uint16_t pageid, const nvmm_line_t* line, nvmm_item_t* item)
+{
+	item->fragments = count_fragments(pageid, line->bottom, line->id, &item->piece_len) ;
+	item->first = (item->fragments > 0)? line->bottom - item->fragments * (item->piece_len + header_slot) : line->data ;
+	item->slot = header_slot ;
+	item->total = (size_t)item->fragments * item->piece_len + line->len ;
+	item->compressed = line->compressed ;
+}
+
+
+/*
+ * check if the latest line of an id at offset is moved to the cold group by the defrag in progress.
+ * it's a hot group line copied by the last defrag and not written since, of an id not declared hot.
+ * references stay where they are.
+ */
+static int is_line_settled(uint16_t pageid, const nvmm_line_t* line, nvmm_off_t offset)
+{
+	nvmm_reference_t ref ;
+
+	return moving && group == NVMM_GROUP_HOT && offset < settled && \
+		(classify == 0 || (* classify)(line->id) == NVMM_CLASS_AUTO) && !read_reference(pageid, line, &ref) ;
+}
+
+
+/*
+ * copy the latest lines to the target page as they are, the references go at last by copy_references.
+ * will return the target content index, 0 if the source page is broken.
+ */
+static nvmm_off_t copy_lines(uint16_t src_pageid, uint16_t tgt_pageid)
+{
+	nvmm_off_t offset_src ;
+	nvmm_off_t offset_tgt ;
+	nvmm_off_t offset_line ;
+	nvmm_off_t fragments ;
+	nvmm_off_t len ;
+	nvmm_reference_t ref ;
+	nvmm_line_t line ;
+
+	offset_tgt = page_base ;
+
+	offset_src = ctindex - header_slot ;
+
+  	while(offset_src >= page_base)
+	{
+		if(read_line(src_pageid, offset_src, &line) != 0)
+		{
+			return 0 ;
+		}
+
+		if(IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter) && is_line_live(src_pageid, &line) && \
+			!read_reference(src_pageid, &line, &ref) && !is_line_settled(src_pageid, &line, offset_src))
+		{//create a new one, together with its fragments.
+			fragments = count_fragments(src_pageid, line.bottom, line.id, &len) ;
+			offset_line = line.bottom - fragments * (len + header_slot) ;
+			copy_line(tgt_pageid, offset_tgt, offset_src + header_slot - offset_line, offset_line);
+
+			offset_tgt += offset_src + header_slot - offset_line ;
+		}
+		
+		offset_src = line.bottom - header_slot ;
+	}
+
+	return copy_references(src_pageid, tgt_pageid, offset_tgt, FORMAT_IN_USE()) ;
+}
+
+
+/*
+ * flash space a line of len bytes takes with its fragments, in the format in use.
+ * a compressed value or a reference is never inline.
+ */
+static size_t line_span(size_t len, uint8_t can_inline)
+{
+	size_t fragments ;
+
+	if(can_inline && len > 0 && len <= inline_max)
+	{
+		return header_slot ;
+	}
+	fragments = (len > 0)? (len - 1) / fragment_len : 0 ;
+
+	return fragments * (fragment_len + header_slot) + PAD_LENGTH(len - fragments * fragment_len) + header_slot ;
+}
+
+
+/*
+ * write the source item to the target page at offset_tgt as the line of lineid, in the format in use.
+ * the source is read by the item offsets, so it can be in the other format.
+ */
+static void write_item(uint16_t src_pageid, const nvmm_item_t* item, uint16_t tgt_pageid, nvmm_off_t offset_tgt, \
+	uint16_t lineid)
+{
+	uint8_t tmp[NVMM_IO_BUFFER_SIZE] ;
+	size_t pos = 0 ;
+	size_t len ;
+	size_t num ;
+	size_t i ;
+
+	if(item->total > 0 && item->total <= inline_max && !item->compressed)
+	{//never fragmented.
+		read_flash(src_pageid, item->first, tmp, item->total) ;
+		write_inline_line(tgt_pageid, offset_tgt, lineid, tmp, item->total) ;
+
+		return ;
+	}
+
+	do
+	{//chunked again to the target fragment length.
+		len = (item->total - pos > fragment_len)? fragment_len : item->total - pos ;
+		begin_line(tgt_pageid, offset_tgt, len) ;
+		for(i=0;i<len;i+=num)
+		{//never read over a source fragment line header.
+			num = (len - i < sizeof(tmp))? len - i : sizeof(tmp) ;
+			if(item->fragments > 0 && num > item->piece_len - (pos + i) % item->piece_len)
+			{
+				num = item->piece_len - (pos + i) % item->piece_len ;
+			}
+			read_flash(src_pageid, (item->fragments > 0)? item->first + (pos + i) / item->piece_len * \
+				(item->piece_len + item->slot) + (pos + i) % item->piece_len : item->first + pos + i, tmp, num) ;
+			write_data(tgt_pageid, offset_tgt + i, tmp, num) ;
+		}
+		pos += len ;
+		if(pos < item->total)
+		{
+			commit_line(tgt_pageid, offset_tgt, lineid, len, NVMM_FRAGMENT_DELIMITER) ;
+		}
+		else
+		{//the compressed flag goes only on the last line.
+			commit_line(tgt_pageid, offset_tgt, item->compressed? lineid | NVMM_COMPRESSED_FLAG : lineid, \
+				len, NVMM_LINE_DELIMITER) ;
+		}
+		offset_tgt += PAD_LENGTH(len) + header_slot ;
+	}while(pos < item->total) ;
+}
+
+
+/*
+ * write a reference line at offset.
+ */
+static void write_reference(uint16_t pageid, nvmm_off_t offset, uint16_t lineid, nvmm_reference_t* ref)
+{
+	begin_line(pageid, offset, sizeof(nvmm_reference_t)) ;
+
+	write_data(pageid, offset, (uint8_t* )ref, sizeof(nvmm_reference_t)) ;
+
+	commit_line(pageid, offset, lineid | NVMM_COMPRESSED_FLAG, sizeof(nvmm_reference_t), NVMM_LINE_DELIMITER) ;
+}
+
+
+/*
+ * find the latest reference above offset to the line at slot.
+ * will return its line id, 0xFFFF for not found.
+ */
+static uint16_t find_reference(uint16_t pageid, nvmm_off_t offset, nvmm_off_t slot)
+{
+	nvmm_off_t index = ctindex - header_slot ;
+	nvmm_reference_t ref ;
+	nvmm_line_t line ;
+
+	while(index > offset)
+	{
+		if(read_line(pageid, index, &line) != 0)
+		{
+			break ;
+		}
+		if(IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter) && read_reference(pageid, &line, &ref) && \
+			ref.slot == slot && is_line_live(pageid, &line))
+		{
+			return line.id ;
+		}
+		index = line.bottom - header_slot ;
+	}
+
+	return 0xFFFF ;
+}
+
+
+/*
+ * copy the latest references to the target page behind the lines, in format.
+ * a reference follows the line it refers to, and if that line isn't copied, the latest reference to it
+ * takes the value, the others refer to that one.
+ * with tgt_pageid NVMM_PAGE_NULL nothing is written, it only checks that they fit.
+ * will return the target content index, 0 if they don't fit or the source page is broken.
+ */
+static nvmm_off_t copy_references(uint16_t src_pageid, uint16_t tgt_pageid, nvmm_off_t offset_tgt, uint8_t format)
+{
+	uint8_t src_format = FORMAT_IN_USE() ;
+	nvmm_off_t offset_src ;
+	nvmm_reference_t ref ;
+	nvmm_line_t line ;
+	nvmm_line_t target ;
+	nvmm_item_t item ;
+	uint16_t owner ;
+	size_t span ;
+
+	offset_src = ctindex - header_slot ;
+	while(offset_src >= page_base)
+	{
+		if(read_line(src_pageid, offset_src, &line) != 0)
+		{
+			return 0 ;
+		}
+
+		if(IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter) && \
+			read_reference(src_pageid, &line, &ref) && is_line_live(src_pageid, &line) && \
+			ref.slot >= page_base && ref.slot < line.bottom && read_line(src_pageid, ref.slot, &target) == 0)
+		{
+			owner = target.id ;
+			if(!is_line_live(src_pageid, &target) || is_line_settled(src_pageid, &target, ref.slot))
+			{//the value isn't copied.
+				owner = find_reference(src_pageid, offset_src, ref.slot) ;
+			}
+			get_item(src_pageid, &target, &item) ;
+
+			use_format(format) ;
+			span = (owner == 0xFFFF)? line_span(item.total, !item.compressed) : line_span(sizeof(nvmm_reference_t), 0) ;
+			if(!IS_LINEID_LEGAL(line.id) || offset_tgt + span > page_size)
+			{
+				use_format(src_format) ;
+				return 0 ;
+			}
+			if(tgt_pageid != NVMM_PAGE_NULL && owner == 0xFFFF)
+			{//the latest reference takes the value.
+				write_item(src_pageid, &item, tgt_pageid, offset_tgt, line.id) ;
+			}
+			else if(tgt_pageid != NVMM_PAGE_NULL)
+			{
+				find_line_address(tgt_pageid, offset_tgt, owner, &target) ;
+				ref.slot = target.data + PAD_LENGTH(target.len) ;
+				write_reference(tgt_pageid, offset_tgt, line.id, &ref) ;
+			}
+			offset_tgt += span ;
+			use_format(src_format) ;
+		}
+
+		offset_src = line.bottom - header_slot ;
+	}
+
+	return offset_tgt ;
+}
+
+
+/*
+ * copy the latest lines to the target page in the configured format, item by item.
+ * the source is read in the format of the page in use, the format is switched for writing every item.
+ * with tgt_pageid NVMM_PAGE_NULL nothing is written, it only checks that all the items fit.
+ * will return the target content index, 0 if they don't fit or the source page is broken.
+ */
+static nvmm_off_t convert_lines(uint16_t src_pageid, uint16_t tgt_pageid)
+{
+	uint8_t format = FORMAT_IN_USE() ;
+	nvmm_off_t offset_src ;
+	nvmm_off_t offset_tgt ;
+	nvmm_reference_t ref ;
+	nvmm_line_t line ;
+	nvmm_item_t item ;
+
+	use_format(header_format) ;
+	offset_tgt = page_base ;
+	use_format(format) ;
+
+	offset_src = ctindex - header_slot ;
+	while(offset_src >= page_base)
+	{
+		if(read_line(src_pageid, offset_src, &line) != 0)
+		{
+			return 0 ;
+		}
+
+		if(IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter) && is_line_live(src_pageid, &line) && \
+			!read_reference(src_pageid, &line, &ref) && !is_line_settled(src_pageid, &line, offset_src))
+		{//the latest line of the id.
+			get_item(src_pageid, &line, &item) ;
+
+			use_format(header_format) ;
+			if(!IS_LINEID_LEGAL(line.id) || offset_tgt + line_span(item.total, !item.compressed) > page_size)
+			{
+				use_format(format) ;
+				return 0 ;
+			}
+			if(tgt_pageid != NVMM_PAGE_NULL)
+			{
+				write_item(src_pageid, &item, tgt_pageid, offset_tgt, line.id) ;
+			}
+			offset_tgt += line_span(item.total, !item.compressed) ;
+			use_format(format) ;
+		}
+
+		offset_src = line.bottom - header_slot ;
+	}
+
+	return copy_references(src_pageid, tgt_pageid, offset_tgt, header_format) ;
+}
+
+
+/*
+ * add an entry to a batch sorted by id, the largest one drops out of a full batch.
+ * an id already in the batch keeps the entry added first.
+ */
+static void add_entry(nvmm_index_t* batch, size_t* num, size_t size, uint16_t lineid, nvmm_off_t slot)
+{
+	nvmm_index_t entry ;
+	size_t i ;
+
+	for(i=0;i<*num;i++)
+	{
+		if(batch[i].id == lineid)
+		{
+			return ;
+		}
+	}
+	if(*num == size && lineid >= batch[*num - 1].id)
+	{
+		return ;
+	}
+
+	memset(&entry, 0xFF, sizeof(nvmm_index_t)) ;
+	entry.id = lineid ;
+	entry.slot = slot ;
+	if(*num < size)
+	{
+		(*num)++ ;
+	}
+	for(i=*num-1;i>0 && batch[i - 1].id > entry.id;i--)
+	{
+		batch[i] = batch[i - 1] ;
+	}
+	batch[i] = entry ;
+}
+
+/*
+ * write the index line of the lines below top, the header slots of the latest lines sorted by id.
+ * the lines are walked down to the index line below them, if any, and its entries are merged in.
+ * the entries are picked by a selection over the lines, a batch of the next smallest ids at a time,
+ * so it takes no more than the batch in RAM.
+ * will return the target content index, top if the lines are too few or the index would take the room reserved.
+ */
+static nvmm_off_t write_index(uint16_t pageid, nvmm_off_t top)
+{
+	nvmm_index_t batch[NVMM_IO_BUFFER_SIZE / sizeof(nvmm_index_t)] ;
+	nvmm_index_t entry ;
+	nvmm_line_t line ;
+	nvmm_line_t index ;
+	nvmm_off_t offset ;
+	nvmm_off_t stop ;
+	nvmm_off_t entries = 0 ;
+	nvmm_off_t i ;
+	size_t count = 0 ;
+	size_t done = 0 ;
+	size_t num ;
+	size_t len ;
+	uint32_t next = 0 ;
+
+	index.len = 0 ;
+	for(offset=top-header_slot;offset>=page_base;offset=line.bottom-header_slot)
+	{
+		if(read_line(pageid, offset, &line) != 0)
+		{
+			return top ;
+		}
+		if(IS_INDEX_DELIMITER(line.delimiter))
+		{//the lines below are all in this one, the blank entries sort last.
+			index = line ;
+			entries = seek_index(pageid, &index, NVMM_INDEX_ID) ;
+			break ;
+		}
+		count += IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter) ;
+	}
+	stop = offset ;
+	count += entries ;
+	len = count * sizeof(nvmm_index_t) ;
+	if(count < NVMM_INDEX_MIN || len > fragment_len || top + PAD_LENGTH(len) + header_slot + reserving > page_size)
+	{
+		return top ;
+	}
+
+	begin_line(pageid, top, len) ;
+	while(done < count)
+	{
+		num = 0 ;
+		//the latest line of an id comes first, the entries merged are older than all of the lines.
+		for(offset=top-header_slot;offset>=page_base && offset!=stop;offset=line.bottom-header_slot)
+		{
+			read_line(pageid, offset, &line) ;
+			if(IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter) && line.id >= next)
+			{
+				add_entry(batch, &num, sizeof(batch) / sizeof(nvmm_index_t), line.id, offset) ;
+			}
+		}
+		for(i=seek_index(pageid, &index, next);i<entries;i++)
+		{
+			read_flash(pageid, index.data + i * sizeof(nvmm_index_t), (uint8_t* )(&entry), sizeof(nvmm_index_t)) ;
+			if(num == sizeof(batch) / sizeof(nvmm_index_t) && entry.id >= batch[num - 1].id)
+			{
+				break ;
+			}
+			add_entry(batch, &num, sizeof(batch) / sizeof(nvmm_index_t), entry.id, entry.slot) ;
+		}
+		if(num == 0)
+		{//an id written twice, the entries left stay blank and sort last.
+			break ;
+		}
+
+		//a full batch is a whole number of program units.
+		write_data(pageid, top + done * sizeof(nvmm_index_t), (uint8_t* )batch, num * sizeof(nvmm_index_t)) ;
+		done += num ;
+		next = batch[num - 1].id + 1 ;
+	}
+	commit_line(pageid, top, NVMM_INDEX_ID, len, NVMM_INDEX_DELIMITER) ;
+
+	return top + PAD_LENGTH(len) + header_slot ;
+}
+
+/*
+ * count the lines written since the last index line, no more than checkpoint.
+ */
+static void count_unindexed(void)
+{
+	nvmm_line_t line ;
+	nvmm_off_t offset ;
+
+	unindexed = 0 ;
+	for(offset=ctindex-header_slot;offset>=page_base && unindexed<checkpoint;offset=line.bottom-header_slot)
+	{
+		if(read_line(activedpage, offset, &line) != 0 || IS_INDEX_DELIMITER(line.delimiter))
+		{
+			break ;
+		}
+		unindexed += IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter) ;
+	}
+}
+
+/*
+ * count a line written, an index checkpoint is appended on every checkpoint lines.
+ * a checkpoint not fitting the page is left to the next defrag.
+ */
+static void checkpoint_line(void)
+{
+	nvmm_off_t top ;
+
+	if(checkpoint == 0 || ++unindexed < checkpoint)
+	{
+		return ;
+	}
+
+	top = write_index(activedpage, ctindex) ;
+	mount_written += top - ctindex ;
+	ctindex = top ;
+	unindexed = 0 ;
+}
+
+
+/*
+ * go through the settled items of the hot group, and append them to the cold group if write is set.
+ * will return the space they take in the cold group, more than a page if some can't go there.
+ */
+static size_t move_lines(uint16_t src_pageid, uint8_t write)
+{
+	nvmm_off_t offset_src ;
+	nvmm_line_t line ;
+	nvmm_item_t item ;
+	size_t span = 0 ;
+	size_t len ;
+
+	offset_src = ctindex - header_slot ;
+	while(offset_src >= page_base)
+	{
+		if(read_line(src_pageid, offset_src, &line) != 0)
+		{
+			return page_size + 1 ;
+		}
+
+		if(IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter) && is_line_live(src_pageid, &line) && \
+			is_line_settled(src_pageid, &line, offset_src))
+		{
+			get_item(src_pageid, &line, &item) ;
+
+			use_group(NVMM_GROUP_COLD) ;
+			len = IS_LINEID_LEGAL(line.id)? line_span(item.total, !item.compressed) : (size_t)page_size + 1 ;
+			if(write)
+			{
+				write_item(src_pageid, &item, activedpage, ctindex, line.id) ;
+				ctindex += len ;
+			}
+			span += len ;
+			use_group(NVMM_GROUP_HOT) ;
+		}
+
+		offset_src = line.bottom - header_slot ;
+	}
+
+	return span ;
+}
+
+
+/*
+ * move the settled items of the hot group to the cold group, all of them or none.
+ * the cold group is defragged first if they don't fit.
+ * will return 1 if they're moved, 0 if they stay in the hot group.
+ */
+static uint8_t move_settled(uint16_t src_pageid)
+{
+	size_t span ;
+	size_t reserved = reserving ;
+	uint8_t room ;
+
+	span = move_lines(src_pageid, 0) ;
+	if(span == 0)
+	{
+		return 1 ;
+	}
+
+	use_group(NVMM_GROUP_COLD) ;
+	if(tail_dirty || ctindex + span > page_size)
+	{
+		reserving = span ;
+		dummy_activedpage() ;
+		defrag_page(activedpage) ;
+		reserving = reserved ;
+	}
+	use_group(NVMM_GROUP_HOT) ;
+
+	//the cold group might be converted to the other format.
+	span = move_lines(src_pageid, 0) ;
+	use_group(NVMM_GROUP_COLD) ;
+	room = (ctindex + span <= page_size) ;
+	use_group(NVMM_GROUP_HOT) ;
+
+	if(room)
+	{
+		move_lines(src_pageid, 1) ;
+	}
+
+	return room ;
+}
+
+
+static int defrag_page(uint16_t src_pageid)
+{
+	nvmm_off_t offset_tgt ;
+	uint16_t tgt_pageid ;//target page id.
+	uint8_t format = FORMAT_IN_USE() ;
+	uint32_t count ;
+
+	tgt_pageid = (src_pageid == page_a_id)? page_b_id : page_a_id ;
+
+	if(group == NVMM_GROUP_HOT)
+	{//the items not written since the last defrag go to the cold group.
+		moving = cold_mounted ;
+		if(moving)
+		{
+			moving = move_settled(src_pageid) ;
+		}
+	}
+
+	if(format != header_format && convert_lines(src_pageid, NVMM_PAGE_NULL) != 0)
+	{//all the items fit in the configured format, convert the page.
+		offset_tgt = convert_lines(src_pageid, tgt_pageid) ;
+		format = header_format ;
+	}
+	else
+	{
+		offset_tgt = copy_lines(src_pageid, tgt_pageid) ;
+	}
+	if(offset_tgt == 0)
+	{
+		return -1 ;
+	}
+	use_format(format) ;
+	offset_tgt = write_index(tgt_pageid, offset_tgt) ;
+	unindexed = 0 ;
+
+	//the target was erased after the source got active, the source is erased right below.
+	count = spare_erases ;
+	spare_erases = erases + 1 ;
+	erases = count ;
+	mount_defrags++ ;
+
+	//active target page.
+	active_page(tgt_pageid) ;
+
+	ctindex = offset_tgt ;
+	settled = ctindex ;
+	tail_dirty = 0 ;
+	generation++ ;
+
+	if(group == NVMM_GROUP_HOT && shadow != 0)
+	{//the shadow follows the active page, the copy was read from it.
+		shadow_load(tgt_pageid) ;
+	}
+	erase_page(src_pageid) ;
+	
+	
+	return 0 ;
+}
+
+
+/*
+ * check current nvmm and see current status of nvmm.
+ * will return 0 for success, -1 for something error.
+ *
+ */
+static int check_nvmm( void )
+{
+	uint32_t state ;
+	uint16_t dummypage = NVMM_PAGE_NULL ;
+	uint8_t cleaned = 0 ;
+
+	activedpage = NVMM_PAGE_NULL;
+
+	//check page A.
+	state = read_page_state(page_a_id) ;
+	if ( state == NVMM_ACTIVE_PAGE_STATE)
+	{//current page is used as actived page.
+		if(activedpage == NVMM_PAGE_NULL)
+		{
+			activedpage = page_a_id ;
+		}
+	}
+	else if(state == NVMM_DUMMY_PAGE_STATE)
+	{//current page is used as dummy page.
+		dummypage = page_a_id ;
+	}
+	else
+	{//no defined page, format it.
+		cleaned += clean_page(page_a_id);
+	}
+	
+	//check page B.
+	state = read_page_state(page_b_id) ;
+	if ( state == NVMM_ACTIVE_PAGE_STATE)
+	{//current page is used as actived page.
+		if(activedpage == NVMM_PAGE_NULL)
+		{//good to go.
+			activedpage = page_b_id ;
+		}
+		else
+		{//found 2actived page, something wrong on last activating. 
+			//format all.
+			clean_page(activedpage);
+			clean_page(page_b_id);
+			activedpage = NVMM_PAGE_NULL;
+		}
+	}
+	else if(state == NVMM_DUMMY_PAGE_STATE)
+	{//current page is used as dummy page.
+		dummypage = page_b_id ;
+	}
+	else
+	{//no defined page, format it.
+		cleaned += clean_page(page_b_id);
+	}
+
+	if (activedpage == NVMM_PAGE_NULL)
+	{//no page actived, normally the 1st time operating current flash.
+		if (dummypage == NVMM_PAGE_NULL)
+		{//good to go, the erases before are not known.
+			use_format(header_format) ;
+			erases = 0 ;
+			spare_erases = 0 ;
+			active_page(page_a_id) ;
+			ctindex = page_base ;
+			settled = page_base ;
+			tail_dirty = 0 ;
+			unindexed = 0 ;
+
+			return 0 ;
+		}
+		else
+		{//last operating hasn't done, complete it now.
+			//copying also hasn't done yet.
+			activedpage = dummypage ;
+			use_format(page_format(dummypage)) ;
+			locate_ctindex() ;
+			read_wear() ;
+			count_unindexed() ;
+			spare_erases += cleaned ;	//the target was formatted above.
+			settled = page_base ;	//not known after a reset, nothing's settled until the next defrag.
+
+			defrag_page(dummypage) ;
+		}
+	}
+	else
+	{//
+		if (dummypage != NVMM_PAGE_NULL)
+		{//last operating hasn't done, complete it now.
+			//copying already done. Just do erase on dummy page.
+			erase_page(dummypage) ;
+		}
+
+		
+		//re-locate the content index.
+		use_format(page_format(activedpage)) ;
+		locate_ctindex() ;
+		read_wear() ;
+		count_unindexed() ;
+		settled = page_base ;
+	}
+
+  return 0 ;
+}
+
+
+/*
+ * keep the mount state in the retained RAM, the cold group only if it's mounted.
+ * an open stream has lines programmed behind ctindex, it's kept once the stream is closed.
+ */
+static void retain_save(void)
+{
+	nvmm_retained_t* state ;
+
+	if(retain == 0 || activedpage == 0xFFFF || stream.opened)
+	{
+		return ;
+	}
+	flush_programs() ;		//the state tells what's on the flash.
+
+	state = (nvmm_retained_t* )retain->state ;
+	state->page_size = page_size ;
+	state->erase_size = erase_size ;
+	state->program_page_size = program_page_size ;
+	state->program_unit = program_unit ;
+	state->header_format = header_format ;
+	park_group(&state->groups[group]) ;
+	if(cold_mounted)
+	{
+		state->groups[!group] = groups[!group] ;
+	}
+
+	retain->check = hash_value((const uint8_t* )retain->state, sizeof(retain->state)) ;
+	retain->mark = NVMM_RETAIN_MARK ;
+}
+
+
+/*
+ * take the state of the group in use out of the retained RAM, page ids set already.
+ * it's taken only if the active page is still active, the other one is erased and nothing's written behind ctindex.
+ * will return 0 for success, -1 if the group has to be mounted from the flash.
+ */
+static int retain_load(void)
+{
+	nvmm_retained_t* state ;
+	nvmm_group_t* saved ;
+	uint8_t slot[NVMM_PROGRAM_UNIT_MAX] ;
+	uint32_t word ;
+	nvmm_off_t i ;
+
+	if(retain == 0 || retain->mark != NVMM_RETAIN_MARK || \
+		retain->check != hash_value((const uint8_t* )retain->state, sizeof(retain->state)))
+	{
+		return -1 ;
+	}
+
+	state = (nvmm_retained_t* )retain->state ;
+	saved = &state->groups[group] ;
+	if(state->page_size != page_size || state->erase_size != erase_size || state->program_page_size != program_page_size || \
+		state->program_unit != program_unit || state->header_format != header_format || \
+		saved->page_a_id != page_a_id || saved->page_b_id != page_b_id || \
+		(saved->activedpage != page_a_id && saved->activedpage != page_b_id))
+	{
+		return -1 ;
+	}
+
+	read_flash(saved->activedpage, 0, (uint8_t* )(&word), sizeof(uint32_t)) ;
+	if(word != NVMM_ACTIVE_PAGE_STATE)
+	{
+		return -1 ;
+	}
+	read_flash((saved->activedpage == page_a_id)? page_b_id : page_a_id, 0, (uint8_t* )(&word), sizeof(uint32_t)) ;
+	if(word != 0xFFFFFFFF)
+	{
+		return -1 ;
+	}
+
+	unpark_group(saved) ;
+	if(ctindex < page_base || ctindex > page_size || header_slot > sizeof(slot))
+	{
+		return -1 ;
+	}
+	if(ctindex + header_slot <= page_size)
+	{
+		read_flash(activedpage, ctindex, slot, header_slot) ;
+		for(i=0;i<header_slot;i++)
+		{
+			if(slot[i] != 0xFF)
+			{
+				return -1 ;
+			}
+		}
+	}
+	mount_defrags = 0 ;
+	mount_written = 0 ;
+
+	return 0 ;
+}
+
+
+/*
+ * forget the state retained, the flash is mounted from scratch.
+ */
+static void retain_reset(void)
+{
+	nvmm_retained_t* state ;
+	uint8_t i ;
+
+	if(retain == 0)
+	{
+		return ;
+	}
+
+	retain->mark = 0 ;
+	state = (nvmm_retained_t* )retain->state ;
+	for(i=0;i<NVMM_GROUP_NUM;i++)
+	{
+		state->groups[i].activedpage = 0xFFFF ;
+	}
+}
+
+
+static void dummy_activedpage(void)
+{
+	uint8_t slot[NVMM_PROGRAM_UNIT_MAX] ;
+
+	memset(slot, 0xFF, sizeof(slot)) ;
+	memset(slot, 0, sizeof(uint32_t)) ;	//NVMM_DUMMY_PAGE_STATE.
+
+	if(IS_STAGED_COMMIT())
+	{
+		write_words(activedpage, 0, slot, sizeof(uint32_t));
+	}
+	else
+	{//the state unit can't be programmed again, use the dummy mark.
+		write_words(activedpage, line_align, slot, line_align);
+	}
+}
+
+
+/*
+ * program the line data, the last unit is padded with erased bytes so the caller's buffer isn't read over.
+ */
+static void write_data(uint16_t pageid, nvmm_off_t offset, uint8_t* dat, size_t datlen)
+{
+	uint8_t tail[NVMM_PROGRAM_UNIT_MAX] ;
+	size_t full ;
+
+	full = datlen - datlen % program_unit ;
+	if(full > 0)
+	{
+		write_words(pageid, offset, dat, full);
+	}
+	if(datlen % program_unit)
+	{
+		memset(tail, 0xFF, sizeof(tail)) ;
+		memcpy(tail, dat + full, datlen % program_unit) ;
+		write_words(pageid, offset + full, tail, program_unit) ;
+	}
+}
+
+
+/*
+ * start a line of len data bytes, staged commit flash gets the line length first.
+ * the length is stored unpadded, the header is right behind the padded data.
+ * the programs of the line are collected from here to commit_line with a vectored write method.
+ */
+static void begin_line(uint16_t pageid, nvmm_off_t offset, nvmm_off_t len)
+{
+	nvmm_lineheader_t header ;
+	nvmm_lineheader_t last ;
+	uint16_t half[2] ;
+	uint16_t before[2] ;
+
+	collecting = (writev_nvwords != 0) ;
+
+	if(compact)
+	{//the low half of the compact header.
+		before[0] = 0xFFFF ;
+		before[1] = 0xFFFF ;
+		half[0] = COMPACT_LOW(len) ;
+		half[1] = 0xFFFF ;
+		write_header_stage(pageid, offset + PAD_LENGTH(len), half, before, sizeof(half)) ;
+		return ;
+	}
+
+	if(!IS_STAGED_COMMIT())
+	{//the whole header goes in commit_line.
+		return ;
+	}
+
+	memset(&last, 0xFF, sizeof(nvmm_lineheader_t)) ;
+	header = last ;
+	header.len = len ;
+	write_header_stage(pageid, offset + PAD_LENGTH(len), &header, &last, sizeof(nvmm_lineheader_t)) ;
+}
+
+
+/*
+ * commit a line after its data, the line delimiter makes it valid.
+ */
+static void commit_line(uint16_t pageid, nvmm_off_t offset, uint16_t lineid, nvmm_off_t len, uint32_t delimiter)
+{
+	nvmm_lineheader_t header ;
+	nvmm_lineheader_t last ;
+	uint8_t slot[NVMM_PROGRAM_UNIT_MAX] ;
+	uint16_t half[2] ;
+	uint16_t before[2] ;
+
+	memset(&header, 0xFF, sizeof(nvmm_lineheader_t)) ;
+	header.len = len ;
+
+	if(compact)
+	{//the high half commits the line.
+		before[0] = COMPACT_LOW(len) ;
+		before[1] = 0xFFFF ;
+		half[0] = before[0] ;
+		half[1] = COMPACT_HIGH(lineid, len, delimiter) ;
+		write_header_stage(pageid, offset + PAD_LENGTH(len), half, before, sizeof(half)) ;
+	}
+	else if(!IS_STAGED_COMMIT())
+	{
+		header.id = lineid ;
+		header.delimiter = delimiter ;
+		memset(slot, 0xFF, sizeof(slot)) ;
+		memcpy(slot, &header, sizeof(nvmm_lineheader_t)) ;
+		write_words(pageid, offset + PAD_LENGTH(len), slot, header_slot) ;
+	}
+	else
+	{
+		last = header ;
+		header.id = lineid ;
+		write_header_stage(pageid, offset + PAD_LENGTH(len), &header, &last, sizeof(nvmm_lineheader_t)) ;
+		last = header ;
+
+		header.delimiter = delimiter ;
+		write_header_stage(pageid, offset + PAD_LENGTH(len), &header, &last, sizeof(nvmm_lineheader_t)) ;
+	}
+
+	flush_programs() ;
+	collecting = 0 ;
+}
+
+
+static void write_line(uint16_t pageid, nvmm_off_t offset, uint16_t lineid, uint8_t* dat, nvmm_off_t len)
+{
+	begin_line(pageid, offset, len) ;
+
+	write_data(pageid, offset, dat, len) ;
+
+	commit_line(pageid, offset, lineid, len, NVMM_LINE_DELIMITER) ;
+}
+
+
+/*
+ * write a value of inline_max bytes or less inline, in a single header slot at offset.
+ * the inline delimiter goes last, it makes the line valid.
+ */
+static void write_inline_line(uint16_t pageid, nvmm_off_t offset, uint16_t lineid, uint8_t* dat, nvmm_off_t len)
+{
+	uint8_t slot[NVMM_PROGRAM_UNIT_MAX] ;
+	uint32_t delimiter = INLINE_DELIMITER(lineid, len) ;
+
+	memset(slot, 0xFF, sizeof(slot)) ;
+	memcpy(slot + inline_offset, dat, len) ;
+
+	if(!IS_STAGED_COMMIT())
+	{
+		memcpy(slot + offsetof(nvmm_lineheader_t, delimiter), &delimiter, sizeof(uint32_t)) ;
+		write_words(pageid, offset, slot, header_slot) ;
+
+		return ;
+	}
+
+	collecting = (writev_nvwords != 0) ;
+	write_words(pageid, offset, slot, offsetof(nvmm_lineheader_t, delimiter)) ;
+	write_words(pageid, offset + offsetof(nvmm_lineheader_t, delimiter), (uint8_t* )&delimiter, sizeof(uint32_t)) ;
+	flush_programs() ;
+	collecting = 0 ;
+}
+
+
+/*
+ * make room for a line of padded_len bytes at ctindex, defrag if needed.
+ * will return 0 for success, -1 if the line can't fit even in a defragged page.
+ */
+static int reserve_line(size_t padded_len)
+{
+	if(tail_dirty || ctindex + padded_len + header_slot > page_size)
+	{
+		reserving = padded_len + header_slot ;
+		dummy_activedpage() ;
+		defrag_page(activedpage) ;
+		reserving = 0 ;
+
+		if(ctindex + padded_len + header_slot > page_size)
+		{//no room even after defrag.
+			return -1 ;
+		}
+	}
+	mount_written += padded_len + header_slot ;
+
+	return 0 ;
+}
+
+
+
+/*
+ * initialize nvmm
+ * need to call this method before using nvmm.
+ * param read, write, erase are all flash operating methods. 
+ * 		NVMM didn't realize them since the methods are platform dependent.
+ *		You need to realize the 3methods in your Application layer or HAL.
+ * 		The addresses in the 3methods are referring to base address 0, you should add the FLASH CHIP ADDRESS in your methods.
+ * param flash_page_a and flash_page_b are the 2flash pages you assigned for the NVMM.
+ * 		The parameters are flash page index, not the physical address of the flash memory.
+ * 		For example, page0 means the 1st page in flash memory(Physical Address might be 0x00000000 + FLASH CHIP ADDRESS), 
+ * 					suppose 2K bytes per page,
+ *					page1 means the 2nd page in flash memory(Physical Address might be 0x00000800 + FLASH CHIP ADDRESS).
+ *		Use 0xFFFF to leave the nvmm to use the default(PAGE A using page1 while PAGE B using page2).
+ *		NOTE. You need to remove the pages assigned for nvmm from your compiler configuration, 
+ *			or else, nvmm will confilits with your firmware image.
+ * param flash_page_size is the page size of your flash, normally it based on the flash type you are using.
+ *		Use 0xFFFF to leave the nvmm to use the default(2K bytes per page).
+ * will return 0 for success executed, -1 for something error.
+ */
+int g_init_nvmm(read_nvbytes_t read, write_nvwords_t write, erase_nvpage_t erase, \
+	uint16_t flash_page_a, uint16_t flash_page_b, uint16_t flash_page_size) 
+{
+	nvmm_geometry_t geometry ;
+
+	geometry.page_size = flash_page_size ;
+	geometry.erase_size = NVMM_ERASE_SIZE_DEFAULT ;
+	geometry.program_page_size = NVMM_PROGRAM_PAGE_SIZE_DEFAULT ;
+	geometry.program_unit = NVMM_PROGRAM_UNIT_DEFAULT ;
+	geometry.header_format = NVMM_HEADER_STANDARD ;
+
+	return g_init_nvmm_geometry(read, write, erase, flash_page_a, flash_page_b, &geometry) ;
+}
+
+
+/*
+ * initialize nvmm with the flash geometry.
+ * the same as g_init_nvmm, but for flash whose erase unit or program page differs from the nvmm page,
+ * such as external SPI NOR flash.
+ * will return 0 for success executed, -1 for something error.
+ */
+int g_init_nvmm_geometry(read_nvbytes_t read, write_nvwords_t write, erase_nvpage_t erase, \
+	uint16_t flash_page_a, uint16_t flash_page_b, const nvmm_geometry_t* geometry) 
+{
+	uint32_t size ;
+	uint32_t erase_unit ;
+	uint32_t unit ;
+	int rc ;
+
+	if(read == 0 || write == 0 || erase == 0 || geometry == 0)
+	{
+		return -1 ;
+	}
+
+	size = (geometry->page_size != 0xFFFF)? geometry->page_size : page_size ;
+	erase_unit = (geometry->erase_size != 0)? geometry->erase_size : size ;
+	unit = (geometry->program_unit != 0)? geometry->program_unit : NVMM_PROGRAM_UNIT_DEFAULT ;
+	if(unit < sizeof(uint16_t) || unit > NVMM_PROGRAM_UNIT_MAX || (unit & (unit - 1)))
+	{//half word, word, double word... up to the flash word of STM32H7.
+		return -1 ;
+	}
+	if(size > NVMM_PAGE_SIZE_MAX || erase_unit == 0 || size % erase_unit || erase_unit % unit || \
+		geometry->program_page_size % unit)
+	{
+		return -1 ;
+	}
+	if(geometry->header_format != NVMM_HEADER_STANDARD && \
+		(geometry->header_format != NVMM_HEADER_COMPACT || unit > sizeof(uint32_t)))
+	{//the compact header is programmed in 2stages.
+		return -1 ;
+	}
+	
+	read_nvbytes = read ;
+	write_nvwords = write ;
+	erase_nvpage = erase ;
+	if(flash_page_a != 0xFFFF)
+	{
+		page_a_id = flash_page_a ;
+	}
+	if(flash_page_b != 0xFFFF)
+	{
+		page_b_id = flash_page_b ;
+	}	
+	page_size = size ;
+	erase_size = erase_unit ;
+	program_page_size = geometry->program_page_size ;
+	program_unit = unit ;
+	header_format = geometry->header_format ;
+	stream.opened = 0 ;
+	mount_defrags = 0 ;
+	mount_written = 0 ;
+	group = NVMM_GROUP_HOT ;
+	cold_mounted = 0 ;
+	moving = 0 ;
+	generation++ ;
+	shadow_page = 0xFFFF ;
+	scan_len = 0 ;
+	pending_num = 0 ;		//never programmed, the same as a power loss before.
+	pending_used = 0 ;
+	collecting = 0 ;
+
+	line_align = (program_unit > sizeof(uint32_t))? program_unit : sizeof(uint32_t) ;
+	
+	if(retain_load() == 0)
+	{//warm reset, the state retained agrees with the flash.
+		rc = 0 ;
+	}
+	else
+	{
+		retain_reset() ;
+		mount_defrags = 0 ;
+		mount_written = 0 ;
+		rc = check_nvmm() ;
+	}
+	if(rc == 0)
+	{
+		shadow_load(activedpage) ;
+	}
+	bloom_build() ;
+	cache_drop(0xFFFF) ;
+	retain_save() ;
+
+	return rc ;
+}
+
+
+/*
+ * compress len bytes of dat with a greedy LZ search over the last bytes of the level window,
+ * the compressed bytes are appended to the open stream if emit is set, otherwise they're only counted.
+ * will return the compressed length.
+ */
+static size_t compress_value(const uint8_t* dat, size_t len, uint8_t level, uint8_t emit)
+{
+	uint8_t group[1 + NVMM_COMPRESS_GROUP * 2] ;
+	uint32_t size = len ;
+	size_t window ;
+	size_t packed = sizeof(uint32_t) ;
+	size_t pos = 0 ;
+	size_t fill = 1 ;
+	size_t items = 0 ;
+	size_t distance ;
+	size_t best = 0 ;
+	size_t best_len ;
+	size_t max ;
+	size_t n ;
+
+	if(level > NVMM_COMPRESS_BEST)
+	{
+		level = NVMM_COMPRESS_BEST ;
+	}
+	window = level * (NVMM_COMPRESS_WINDOW / NVMM_COMPRESS_BEST) ;
+	if(emit)
+	{//the length goes first.
+		g_append_nvmm(&size, sizeof(uint32_t)) ;
+	}
+
+	group[0] = 0 ;
+	while(pos < len)
+	{
+		best_len = 0 ;
+		max = (len - pos < NVMM_COMPRESS_MAXMATCH)? len - pos : NVMM_COMPRESS_MAXMATCH ;
+		for(distance=1;distance<=window && distance<=pos && best_len<max;distance++)
+		{
+			n = 0 ;
+			while(n < max && dat[pos + n - distance] == dat[pos + n])
+			{
+				n++ ;
+			}
+			if(n > best_len)
+			{
+				best_len = n ;
+				best = distance ;
+			}
+		}
+
+		if(best_len >= NVMM_COMPRESS_MINMATCH)
+		{
+			group[0] |= 1 << items ;
+			group[fill++] = (uint8_t)(best - 1) ;
+			group[fill++] = (uint8_t)(best_len - NVMM_COMPRESS_MINMATCH) ;
+			pos += best_len ;
+		}
+		else
+		{
+			group[fill++] = dat[pos++] ;
+		}
+
+		if(++items == NVMM_COMPRESS_GROUP || pos == len)
+		{
+			if(emit)
+			{
+				g_append_nvmm(group, fill) ;
+			}
+			packed += fill ;
+			group[0] = 0 ;
+			fill = 1 ;
+			items = 0 ;
+		}
+	}
+
+	return packed ;
+}
+
+
+/*
+ * get the next compressed byte.
+ * will return 0 for success, -1 if the compressed bytes run out.
+ */
+static int next_compressed(nvmm_decompress_t* state, uint8_t* byte)
+{
+	if(state->in_pos == state->in_len)
+	{
+		state->in_len = (state->raw.left < sizeof(state->in))? state->raw.left : sizeof(state->in) ;
+		if(state->in_len == 0 || g_read_nvmm_cursor(&state->raw, state->in, state->in_len) != 0)
+		{
+			return -1 ;
+		}
+		state->in_pos = 0 ;
+	}
+	*byte = state->in[state->in_pos++] ;
+
+	return 0 ;
+}
+
+
+/*
+ * decompress the value of a compressed item cursor from its start, skip bytes and then len bytes to buf,
+ * or compare them with reference if buf is 0. only the window of the last decompressed bytes is kept, 
+ * so any part of the value is decompressed in bounded RAM.
+ * will return 0 for success, -1 for broken data or a difference from reference.
+ */
+static int decompress_value(const nvmm_cursor_t* cursor, size_t skip, uint8_t* buf, const uint8_t* reference, size_t len)
+{
+	nvmm_decompress_t state ;
+	uint8_t control = 0 ;
+	uint8_t token[2] ;
+	uint8_t byte ;
+	size_t items = 0 ;
+	size_t distance ;
+	size_t count ;
+	size_t pos = 0 ;
+	size_t end = skip + len ;
+
+	state.raw = *cursor ;
+	state.raw.left = cursor->compressed ;
+	state.raw.compressed = 0 ;
+	state.in_pos = 0 ;
+	state.in_len = 0 ;
+
+	while(pos < end)
+	{
+		if(items == 0)
+		{
+			if(next_compressed(&state, &control) != 0)
+			{
+				return -1 ;
+			}
+			items = NVMM_COMPRESS_GROUP ;
+		}
+
+		if(next_compressed(&state, &token[0]) != 0)
+		{
+			return -1 ;
+		}
+		distance = 0 ;
+		count = 1 ;
+		if(control & 1)
+		{//a match of the bytes distance back.
+			if(next_compressed(&state, &token[1]) != 0)
+			{
+				return -1 ;
+			}
+			distance = token[0] + 1 ;
+			count = token[1] + NVMM_COMPRESS_MINMATCH ;
+			if(distance > pos)
+			{
+				return -1 ;
+			}
+		}
+		control >>= 1 ;
+		items-- ;
+
+		for(;count>0 && pos<end;count--)
+		{
+			byte = (distance != 0)? state.window[(pos - distance) % NVMM_COMPRESS_WINDOW] : token[0] ;
+			state.window[pos % NVMM_COMPRESS_WINDOW] = byte ;
+			if(pos >= skip && buf != 0)
+			{
+				buf[pos - skip] = byte ;
+			}
+			else if(pos >= skip && reference[pos - skip] != byte)
+			{
+				return -1 ;
+			}
+			pos++ ;
+		}
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * mount the cold page group, an interrupted defrag of it is completed the same as g_init_nvmm does.
+ * return 0 if executed succeed.
+ */
+int g_init_nvmm_cold(uint16_t flash_page_a, uint16_t flash_page_b, classify_nvmm_t classify_id)
+{
+	int rc ;
+
+	if(read_nvbytes == 0 || stream.opened || group != NVMM_GROUP_HOT || flash_page_a == flash_page_b || \
+		flash_page_a == NVMM_PAGE_NULL || flash_page_b == NVMM_PAGE_NULL || \
+		flash_page_a == page_a_id || flash_page_a == page_b_id || flash_page_b == page_a_id || flash_page_b == page_b_id)
+	{
+		return -1 ;
+	}
+
+	//the cold group is formatted with the header format of the hot one if it's erased.
+	cold_mounted = 0 ;
+	groups[NVMM_GROUP_COLD].format = header_format ;
+	use_group(NVMM_GROUP_COLD) ;
+	page_a_id = flash_page_a ;
+	page_b_id = flash_page_b ;
+	mount_defrags = 0 ;
+	mount_written = 0 ;
+	rc = (retain_load() == 0)? 0 : check_nvmm() ;
+	use_group(NVMM_GROUP_HOT) ;
+
+	classify = classify_id ;
+	cold_mounted = (rc == 0) ;
+	generation++ ;
+	bloom_build() ;
+	cache_drop(0xFFFF) ;
+	retain_save() ;
+
+	return rc ;
+}
+
+
+/*
+ * set the compression level callback.
+ * return 0 if executed succeed.
+ */
+int g_compress_nvmm(compress_nvmm_t level)
+{
+	compress_level = level ;
+
+	return 0 ;
+}
+
+
+/*
+ * set value deduplication.
+ * return 0 if executed succeed.
+ */
+int g_dedup_nvmm(uint8_t enable)
+{
+	dedup = enable ;
+
+	return 0 ;
+}
+
+
+/*
+ * set the checksum hook.
+ * return 0 if executed succeed.
+ */
+int g_checksum_nvmm(checksum_nvmm_t hook)
+{
+	checksum = hook ;
+
+	return 0 ;
+}
+
+
+/*
+ * set the lines written between two index checkpoints.
+ * return 0 if executed succeed.
+ */
+int g_checkpoint_nvmm(size_t lines)
+{
+	checkpoint = lines ;
+
+	if(activedpage != 0xFFFF)
+	{
+		count_unindexed() ;
+	}
+	if(cold_mounted)
+	{
+		use_group(NVMM_GROUP_COLD) ;
+		count_unindexed() ;
+		use_group(NVMM_GROUP_HOT) ;
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * set the bloom filter of the ids written, size bytes of bits, 0 for no filter.
+ * return 0 if executed succeed.
+ */
+int g_bloom_nvmm(uint8_t* bits, size_t size)
+{
+	bloom = (size != 0)? bits : 0 ;
+	bloom_bits = size * 8 ;
+
+	if(activedpage != 0xFFFF)
+	{
+		bloom_build() ;
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * set the value cache.
+ * return 0 if executed succeed.
+ */
+int g_cache_nvmm(nvmm_cache_t* entries, size_t num)
+{
+	cache = (num != 0)? entries : 0 ;
+	cache_num = num ;
+	cache_drop(0xFFFF) ;
+	cache_hits = 0 ;
+	cache_misses = 0 ;
+
+	return 0 ;
+}
+
+
+/*
+ * set the RAM shadow of the active page.
+ * return 0 if executed succeed, -1 if the RAM is less than a page.
+ */
+int g_shadow_nvmm(uint8_t* ram, size_t size, read_nvbytes_t fill)
+{
+	if(size != 0 && (ram == 0 || (activedpage != 0xFFFF && size < page_size)))
+	{
+		return -1 ;
+	}
+
+	shadow = (size != 0)? ram : 0 ;
+	shadow_size = size ;
+	shadow_fill = fill ;
+	shadow_page = 0xFFFF ;
+	if(activedpage != 0xFFFF)
+	{
+		shadow_load(activedpage) ;
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * set the readahead window of the header scans.
+ * return 0 if executed succeed, -1 if the RAM is missing.
+ */
+int g_scan_nvmm(uint8_t* ram, size_t size)
+{
+	if(size != 0 && ram == 0)
+	{
+		return -1 ;
+	}
+
+	scan = (size != 0)? ram : 0 ;
+	scan_size = size ;
+	scan_len = 0 ;
+
+	return 0 ;
+}
+
+
+/*
+ * set the vectored flash methods.
+ * return 0 if executed succeed, -1 for readv without writev.
+ */
+int g_vector_nvmm(readv_nvbytes_t readv, writev_nvwords_t writev)
+{
+	if(readv != 0 && writev == 0)
+	{
+		return -1 ;
+	}
+
+	flush_programs() ;
+	readv_nvbytes = readv ;
+	writev_nvwords = writev ;
+	collecting = 0 ;
+
+	return 0 ;
+}
+
+
+/*
+ * set the retained RAM of the mount state.
+ * return 0 if executed succeed.
+ */
+int g_retain_nvmm(nvmm_retain_t* block)
+{
+	retain = block ;
+	retain_save() ;
+
+	return 0 ;
+}
+
+
+/*
+ * find the latest line of id, in the group it's written in first, then in the other one.
+ * the group of the line is left in use, the caller restores its own.
+ * will return the line data offset and give the line to line, 0 for not found.
+ */
+static nvmm_off_t find_item_line(uint16_t id, nvmm_line_t* line)
+{
+	uint8_t first = id_group(id) ;
+	uint8_t i ;
+
+	for(i=0;i<(cold_mounted? NVMM_GROUP_NUM : 1);i++)
+	{
+		use_group((i == 0)? first : !first) ;
+		if(find_line_address(activedpage, ctindex, id, line) != 0)
+		{
+			return line->data ;
+		}
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * check if the item of a cursor just opened at its start is dat.
+ */
+static int is_value_same(nvmm_cursor_t* cursor, const uint8_t* dat, size_t len)
+{
+	uint8_t tmp[NVMM_IO_BUFFER_SIZE] ;
+	size_t num ;
+
+	if(cursor->left != len)
+	{//a shorter value isn't the same even if the stored one starts with it.
+		return 0 ;
+	}
+	if(cursor->compressed != 0)
+	{//compared in one pass.
+		return (decompress_value(cursor, 0, 0, dat, len) == 0) ;
+	}
+
+	while(len > 0)
+	{
+		num = (len < sizeof(tmp))? len : sizeof(tmp) ;
+		if(g_read_nvmm_cursor(cursor, tmp, num) != 0 || memcmp(tmp, dat, num) != 0)
+		{
+			return 0 ;
+		}
+		dat += num ;
+		len -= num ;
+	}
+
+	return 1 ;
+}
+
+
+/*
+ * check if the value of id is already dat, so it needn't be written again.
+ * a reference keeps the checksum of its value, a different one tells the value changed without reading it.
+ */
+static int is_line_same(uint16_t id, const uint8_t* dat, size_t len)
+{
+	nvmm_cursor_t cursor ;
+	nvmm_reference_t ref ;
+	nvmm_line_t line ;
+	uint8_t prev = group ;
+	int rc = 0 ;
+
+	if(!bloom_id(id, 0))
+	{//never written.
+		return 0 ;
+	}
+
+	if(find_item_line(id, &line) != 0 && (!read_reference(activedpage, &line, &ref) || \
+		(ref.size == (len | NVMM_REFERENCE_MARK) && ref.hash == hash_value(dat, len))))
+	{//the same checksum may still be another value, so it's compared anyway.
+		rc = (open_line_cursor(&cursor, &line, 0, 1) == 0 && is_value_same(&cursor, dat, len)) ;
+	}
+	use_group(prev) ;
+
+	return rc ;
+}
+
+
+/*
+ * CRC-32 the same as the STM32 CRC unit gives, dat fed to it as little endian words and the tail padded with 0.
+ * a table of 16 entries takes a nibble at a time, small enough for the parts without the unit.
+ */
+static uint32_t crc_value(const uint8_t* dat, size_t len)
+{
+	static const uint32_t table[16] = {
+		0x00000000, 0x04C11DB7, 0x09823B6E, 0x0D4326D9, 0x130476DC, 0x17C56B6B, 0x1A864DB2, 0x1E475005,
+		0x2608EDB8, 0x22C9F00F, 0x2F8AD6D6, 0x2B4BCB61, 0x350C9B64, 0x31CD86D3, 0x3C8EA00A, 0x384FBDBD
+	} ;
+	uint32_t crc = 0xFFFFFFFF ;
+	uint32_t word ;
+	size_t i ;
+
+	while(len > 0)
+	{
+		word = 0 ;
+		for(i=0;i<sizeof(uint32_t) && i<len;i++)
+		{
+			word |= (uint32_t)dat[i] << (i * 8) ;
+		}
+		dat += i ;
+		len -= i ;
+
+		crc ^= word ;
+		for(i=0;i<8;i++)
+		{
+			crc = (crc << 4) ^ table[crc >> 28] ;
+		}
+	}
+
+	return crc ;
+}
+
+
+/*
+ * checksum of a value, by the hook if it's set.
+ */
+static uint32_t hash_value(const uint8_t* dat, size_t len)
+{
+	if(checksum != 0)
+	{
+		return (* checksum)(dat, len) ;
+	}
+
+	return crc_value(dat, len) ;
+}
+
+
+/*
+ * find a line holding the value dat of hash, any line of any id will do, the superseded ones too.
+ * a reference of the same hash gives the line it refers to.
+ * will return the header slot offset of the line, 0 for not found.
+ */
+static nvmm_off_t find_same_value(const uint8_t* dat, size_t len, uint32_t hash)
+{
+	nvmm_off_t offset = ctindex - header_slot ;
+	nvmm_reference_t ref ;
+	nvmm_cursor_t cursor ;
+	nvmm_line_t line ;
+
+	while(offset >= page_base)
+	{
+		if(read_line(activedpage, offset, &line) != 0)
+		{
+			return 0 ;
+		}
+
+		if(IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter) && read_reference(activedpage, &line, &ref))
+		{
+			if(ref.hash == hash && ref.size == (len | NVMM_REFERENCE_MARK) && \
+				open_line_cursor(&cursor, &line, 0, 1) == 0 && is_value_same(&cursor, dat, len))
+			{
+				return ref.slot ;
+			}
+		}
+		else if(IS_LINEID_LEGAL(line.id) && IS_LINEDELIMITER_LEGAL(line.delimiter))
+		{//fragments are compared together with their line.
+			if(open_line_cursor(&cursor, &line, 0, 0) == 0 && is_value_same(&cursor, dat, len))
+			{
+				return offset ;
+			}
+		}
+
+		offset = line.bottom - header_slot ;
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * write an item.
+ * an item longer than a line is chunked into fragments and committed at once by the stream.
+ * return 0 if executed succeed.
+ */
+static int write_nvmm(uint16_t id, size_t len, void* dat)
+{
+	size_t padded_len ;
+	size_t packed_len ;
+	uint32_t generation_now ;
+	nvmm_reference_t ref ;
+	uint8_t level ;
+	int rc ;
+
+	if(stream.opened)
+	{//the stream owns ctindex until closed.
+		return -1 ;
+	}
+	cache_drop(id) ;
+	if(group != id_group(id))
+	{//declared cold, written in the cold group.
+		use_group(id_group(id)) ;
+		rc = write_nvmm(id, len, dat) ;
+		use_group(NVMM_GROUP_HOT) ;
+
+		return rc ;
+	}
+	if(!IS_LINEID_LEGAL(id))
+	{
+		return -1 ;
+	}
+
+	if(is_line_same(id, dat, len))
+	{//no change.
+		return 0 ;
+	}
+	bloom_id(id, 1) ;
+
+	if(dedup && len > NVMM_PROGRAM_UNIT_MAX)
+	{//refer to a line holding the same value.
+		ref.size = len | NVMM_REFERENCE_MARK ;
+		ref.hash = hash_value(dat, len) ;
+		ref.slot = find_same_value(dat, len, ref.hash) ;
+		generation_now = generation ;
+		if(ref.slot != 0 && reserve_line(PAD_LENGTH(sizeof(nvmm_reference_t))) != 0)
+		{
+			return -1 ;
+		}
+		if(ref.slot != 0 && generation_now != generation)
+		{//the lines are moved by the defrag.
+			ref.slot = find_same_value(dat, len, ref.hash) ;
+		}
+		if(ref.slot != 0)
+		{
+			write_reference(activedpage, ctindex, id, &ref) ;
+			ctindex += PAD_LENGTH(sizeof(nvmm_reference_t)) + header_slot ;
+			checkpoint_line() ;
+
+			return 0 ;
+		}
+	}
+
+	level = (compress_level != 0 && len > NVMM_PROGRAM_UNIT_MAX)? (* compress_level)(id, len) : NVMM_COMPRESS_NONE ;
+	if(level != NVMM_COMPRESS_NONE)
+	{//compressed only if it saves flash, a compressed line is never inline however short it is.
+		packed_len = compress_value(dat, len, level, 0) ;
+		if(PAD_LENGTH(packed_len) < PAD_LENGTH(len))
+		{
+			if(g_open_nvmm(id, packed_len) != 0)
+			{
+				return -1 ;
+			}
+			stream.compressed = 1 ;
+			compress_value(dat, len, level, 1) ;
+
+			return g_close_nvmm() ;
+		}
+	}
+
+	padded_len = PAD_LENGTH(len) ;
+	if(padded_len > fragment_len)
+	{//too long for a line, chunk it.
+		if(g_open_nvmm(id, len) != 0)
+		{
+			return -1 ;
+		}
+		g_append_nvmm(dat, len) ;
+
+		return g_close_nvmm() ;
+	}
+
+	if(len > 0 && len <= inline_max)
+	{//small enough to be kept in the header slot.
+		if(reserve_line(0) != 0)
+		{
+			return -1 ;
+		}
+		write_inline_line(activedpage, ctindex, id, dat, len) ;
+		ctindex += header_slot ;
+		checkpoint_line() ;
+
+		return 0 ;
+	}
+
+	if(reserve_line(padded_len) != 0)
+	{
+		return -1 ;
+	}
+
+  
+	write_line(activedpage, ctindex, id, dat, len) ;
+
+
+	ctindex += padded_len + header_slot ;
+	checkpoint_line() ;
+
+
+	return 0 ;
+}
+
+
+
+/*
+ * write NVMM
+ * You need to specify an id, all read and write are based on the id later.
+ * return 0 if executed succeed.
+ */
+int g_write_nvmm(uint16_t id, size_t len, void* dat)
+{
+	int rc ;
+
+	rc = write_nvmm(id, len, dat) ;
+	retain_save() ;
+
+	return rc ;
+}
+
+
+/*
+ * look id up in the value cache.
+ * will return the entry, 0 for a miss or no cache.
+ */
+static nvmm_cache_t* cache_lookup(uint16_t id)
+{
+	size_t i ;
+
+	if(cache == 0)
+	{
+		return 0 ;
+	}
+
+	for(i=0;i<cache_num;i++)
+	{
+		if(cache[i].used != 0 && cache[i].id == id)
+		{
+			cache[i].used = ++cache_clock ;
+			cache_hits++ ;
+			return &cache[i] ;
+		}
+	}
+	cache_misses++ ;
+
+	return 0 ;
+}
+
+/*
+ * keep the value of id in the cache, in place of the least recently used entry.
+ */
+static void cache_store(uint16_t id, const void* dat, size_t len)
+{
+	nvmm_cache_t* entry ;
+	size_t i ;
+
+	if(cache == 0 || len > NVMM_CACHE_VALUE_MAX)
+	{
+		return ;
+	}
+
+	entry = &cache[0] ;
+	for(i=1;i<cache_num;i++)
+	{
+		if(cache[i].used < entry->used)
+		{
+			entry = &cache[i] ;
+		}
+	}
+	entry->id = id ;
+	entry->len = len ;
+	entry->used = ++cache_clock ;
+	memcpy(entry->value, dat, len) ;
+}
+
+/*
+ * drop the value of id from the cache, or all the values with id 0xFFFF.
+ */
+static void cache_drop(uint16_t id)
+{
+	size_t i ;
+
+	for(i=0;cache!=0 && i<cache_num;i++)
+	{
+		if(id == 0xFFFF || cache[i].id == id)
+		{
+			cache[i].used = 0 ;
+		}
+	}
+}
+
+
+/*
+ * read NVMM.
+ * read NVMM item to specified buffer
+ * return 0 if executed succeed.
+ * will also return -1 if reading a no- written item or len is over the stored length.
+ */
+int g_read_nvmm(uint16_t id, size_t len, void *buf, size_t bufsize)
+{
+	nvmm_cursor_t cursor ;
+	nvmm_cache_t* entry ;
+	size_t left ;
+	
+	if(buf == 0 || len == 0 || bufsize == 0 || bufsize < len)
+	{
+		return -1 ;
+	}
+
+	entry = cache_lookup(id) ;
+	if(entry != 0)
+	{
+		if(len > entry->len)
+		{
+			return -1 ;
+		}
+		memcpy(buf, entry->value, len) ;
+		return 0 ;
+	}
+	
+	if(g_open_nvmm_cursor(&cursor, id, 0) != 0)
+	{
+		return -1 ;
+	}
+	left = cursor.left ;
+	if(g_read_nvmm_cursor(&cursor, buf, len) != 0)
+	{
+		return -1 ;
+	}
+	if(left == len)
+	{//read whole.
+		cache_store(id, buf, len) ;
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * read NVMM at an offset.
+ * read len bytes from offset inside the line of id, only the bytes asked for are read from flash.
+ * return 0 if executed succeed, -1 for a no- written item or reading over the line.
+ */
+int g_read_nvmm_at(uint16_t id, size_t offset, size_t len, void* buf, size_t bufsize)
+{
+	nvmm_cursor_t cursor ;
+	nvmm_cache_t* entry ;
+
+	if(buf == 0 || len == 0 || bufsize < len)
+	{
+		return -1 ;
+	}
+
+	entry = cache_lookup(id) ;
+	if(entry != 0)
+	{
+		if(offset > entry->len || len > entry->len - offset)
+		{
+			return -1 ;
+		}
+		memcpy(buf, entry->value + offset, len) ;
+		return 0 ;
+	}
+
+	if(g_open_nvmm_cursor(&cursor, id, offset) != 0)
+	{
+		return -1 ;
+	}
+
+	return g_read_nvmm_cursor(&cursor, buf, len) ;
+}
+
+
+/*
+ * read a whole NVMM item and get its stored length.
+ * return 0 if executed succeed.
+ * will also return -1 if reading a no- written item or the buffer is too small, len still gets the length then.
+ */
+int g_read_nvmm_len(uint16_t id, void* buf, size_t bufsize, size_t* len)
+{
+	nvmm_cursor_t cursor ;
+	nvmm_cache_t* entry ;
+
+	if(buf == 0 || len == 0)
+	{
+		return -1 ;
+	}
+	*len = 0 ;
+
+	entry = cache_lookup(id) ;
+	if(entry != 0)
+	{
+		*len = entry->len ;
+		if(bufsize < entry->len)
+		{
+			return -1 ;
+		}
+		memcpy(buf, entry->value, entry->len) ;
+		return 0 ;
+	}
+
+	if(g_open_nvmm_cursor(&cursor, id, 0) != 0)
+	{
+		return -1 ;
+	}
+	*len = cursor.left ;
+	if(cursor.left == 0)
+	{
+		cache_store(id, buf, 0) ;
+		return 0 ;
+	}
+	if(bufsize < cursor.left)
+	{
+		return -1 ;
+	}
+	if(g_read_nvmm_cursor(&cursor, buf, cursor.left) != 0)
+	{
+		return -1 ;
+	}
+	cache_store(id, buf, *len) ;
+
+	return 0 ;
+}
+
+
+/*
+ * get the stored length of a NVMM item.
+ * return the length, -1 for a no- written item.
+ */
+long g_nvmm_size(uint16_t id)
+{
+	nvmm_cursor_t cursor ;
+	nvmm_cache_t* entry ;
+
+	entry = cache_lookup(id) ;
+	if(entry != 0)
+	{
+		return entry->len ;
+	}
+
+	if(g_open_nvmm_cursor(&cursor, id, 0) != 0)
+	{
+		return -1 ;
+	}
+
+	return cursor.left ;
+}
+
+
+/*
+ * open a read cursor at offset inside the item line commits, a reference is followed to the line it refers to
+ * if follow is set.
+ * will return 0 for success, -1 for an offset over the item or a broken reference.
+ */
+static int open_line_cursor(nvmm_cursor_t* cursor, const nvmm_line_t* line, size_t offset, uint8_t follow)
+{
+	nvmm_off_t address = line->data ;
+	nvmm_off_t len = line->len ;
+	nvmm_off_t fragments ;
+	nvmm_off_t piece_len ;
+	nvmm_off_t piece ;
+	nvmm_reference_t ref ;
+	nvmm_line_t target ;
+	size_t total ;
+	size_t position = 0 ;
+
+	fragments = count_fragments(activedpage, line->bottom, line->id, &piece_len) ;
+	total = (size_t)fragments * piece_len + len ;
+	if(line->compressed)
+	{//the cursor stays at the start of the compressed bytes, offset is taken by decompressing.
+		position = offset ;
+		offset = 0 ;
+	}
+	if(offset > total)
+	{
+		return -1 ;
+	}
+
+	//the piece holding offset, the last line is the piece after the fragments.
+	piece = (fragments > 0)? offset / piece_len : 0 ;
+	if(piece > fragments)
+	{
+		piece = fragments ;
+	}
+	address -= (fragments - piece) * (piece_len + header_slot) ;
+	offset -= (size_t)piece * piece_len ;
+
+	cursor->address = FLASH_ADDRESS(activedpage, address + offset) ;
+	cursor->left = total - piece * piece_len - offset ;
+	cursor->fragment_left = ((piece < fragments)? piece_len : len) - offset ;
+	cursor->fragment_len = piece_len ;
+	cursor->header_slot = header_slot ;
+	cursor->generation = generation ;
+	cursor->compressed = 0 ;
+	cursor->position = 0 ;
+
+	if(!line->compressed)
+	{
+		return 0 ;
 	}
-	else
-	{//no defined page, format it.
-		clean_page(page_a_id);
+
+	//behind the length of the value.
+	if(g_read_nvmm_cursor(cursor, &ref.size, sizeof(uint32_t)) != 0)
+	{
+		return -1 ;
 	}
-	
-	//check page B.
-	(* read_nvbytes)(FLASH_ADDRESS(page_b_id, 0), (uint8_t* )(&header), \
-					sizeof(nvmm_pageheader_t), sizeof(nvmm_pageheader_t)) ;
-	if ( header.state == NVMM_ACTIVE_PAGE_STATE)
-	{//current page is used as actived page.
-		if(activedpage == NVMM_PAGE_NULL)
-		{//good to go.
-			activedpage = page_b_id ;
-		}
-		else
-		{//found 2actived page, something wrong on last activating. 
-			//format all.
-			clean_page(activedpage);
-			clean_page(page_b_id);
-			activedpage = NVMM_PAGE_NULL;
+	if(ref.size & NVMM_REFERENCE_MARK)
+	{//a reference never refers to a reference.
+		if(!follow || g_read_nvmm_cursor(cursor, &ref.hash, sizeof(uint32_t)) != 0 || \
+			g_read_nvmm_cursor(cursor, &ref.slot, sizeof(uint32_t)) != 0 || \
+			ref.slot < page_base || ref.slot >= line->bottom || read_line(activedpage, ref.slot, &target) != 0 || \
+			!IS_LINEID_LEGAL(target.id) || !IS_LINEDELIMITER_LEGAL(target.delimiter) || \
+			open_line_cursor(cursor, &target, position, 0) != 0 || \
+			cursor->left + position != (ref.size & ~NVMM_REFERENCE_MARK))
+		{
+			return -1 ;
 		}
+
+		return 0 ;
 	}
-	else if(header.state == NVMM_DUMMY_PAGE_STATE)
-	{//current page is used as dummy page.
-		dummypage = page_b_id ;
+	if(position > ref.size)
+	{
+		return -1 ;
 	}
-	else
-	{//no defined page, format it.
-		clean_page(page_b_id);
+	cursor->compressed = cursor->left ;
+	cursor->left = ref.size - position ;
+	cursor->position = position ;
+
+	return 0 ;
+}
+
+
+/*
+ * open a NVMM read cursor.
+ * locate the line of id once and place the cursor at offset inside it.
+ * return 0 if executed succeed, -1 for a no- written item or an offset over the line.
+ */
+int g_open_nvmm_cursor(nvmm_cursor_t* cursor, uint16_t id, size_t offset)
+{
+	nvmm_line_t line ;
+	uint8_t prev = group ;
+	int rc = -1 ;
+
+	if(cursor == 0 || read_nvbytes == 0)
+	{
+		return -1 ;
+	}
+	if(!bloom_id(id, 0))
+	{//never written, no need to look.
+		return -1 ;
 	}
 
-	if (activedpage == NVMM_PAGE_NULL)
-	{//no page actived, normally the 1st time operating current flash.
-		if (dummypage == NVMM_PAGE_NULL)
-		{//good to go.
-			active_page(page_a_id) ;
-			ctindex = sizeof(nvmm_pageheader_t) ;
+	//the group the id is written in goes first, the hot one for an item moved to the cold group.
+	if(find_item_line(id, &line) != 0)
+	{
+		rc = open_line_cursor(cursor, &line, offset, 1) ;
+	}
+	use_group(prev) ;
 
-			return 0 ;
-		}
-		else
-		{//last operating hasn't done, complete it now.
-			//copying also hasn't done yet.
-			activedpage = dummypage ;
-			locate_ctindex() ;
+	return rc ;
+}
 
-			defrag_page(dummypage) ;
+
+/*
+ * read NVMM from a cursor.
+ * read the next len bytes and move the cursor over them.
+ * the cursor keeps reading the line it was opened on even if the id is written again,
+ * but it's invalid after a defrag moved the lines.
+ * return 0 if executed succeed, -1 for reading over the line or an invalid cursor.
+ */
+int g_read_nvmm_cursor(nvmm_cursor_t* cursor, void* buf, size_t len)
+{
+	uint8_t* dest = (uint8_t* )buf ;
+	size_t num ;
+
+	if(cursor == 0 || buf == 0 || len == 0 || len > cursor->left || cursor->generation != generation)
+	{
+		return -1 ;
+	}
+
+	if(cursor->compressed != 0)
+	{//decompressed from the start of the value every time.
+		if(decompress_value(cursor, cursor->position, dest, 0, len) != 0)
+		{
+			return -1 ;
 		}
+		cursor->position += len ;
+		cursor->left -= len ;
+
+		return 0 ;
 	}
-	else
-	{//
-		if (dummypage != NVMM_PAGE_NULL)
-		{//last operating hasn't done, complete it now.
-			//copying already done. Just do erase on dummy page.
-			erase_page(dummypage) ;
+
+	while(len > 0)
+	{
+		if(cursor->fragment_left == 0)
+		{//step over the fragment line header to the next piece.
+			cursor->address += cursor->header_slot ;
+			cursor->fragment_left = (cursor->left < cursor->fragment_len)? cursor->left : cursor->fragment_len ;
 		}
 
-		
-		//re-locate the content index.
-		locate_ctindex() ;
+		num = (len < cursor->fragment_left)? len : cursor->fragment_left ;
+		read_address(cursor->address, dest, num) ;
+		cursor->address += num ;
+		cursor->left -= num ;
+		cursor->fragment_left -= num ;
+		dest += num ;
+		len -= num ;
 	}
 
-  return 0 ;
+	return 0 ;
 }
 
 
-static void dummy_activedpage(void)
-{
-	nvmm_pageheader_t header ;
 
-	header.state = NVMM_DUMMY_PAGE_STATE;
 
-	write_word(activedpage, 0, (uint8_t* )(&header.state));
+/*
+ * offset of the byte at pos of the stream value, the fragment line headers are stepped over.
+ */
+static nvmm_off_t stream_offset(size_t pos)
+{
+	return stream.offset + (pos / fragment_len) * (fragment_len + header_slot) + pos % fragment_len ;
 }
 
 
-static void write_line(uint16_t pageid, uint16_t offset, uint16_t lineid, uint16_t len, uint8_t* dat)
+/*
+ * open a NVMM stream.
+ * start writing a value of len bytes in pieces by g_append_nvmm, it's not readable until g_close_nvmm.
+ * a value longer than a line is chunked into fragments.
+ * return 0 if executed succeed, -1 if another stream is open or the value can't fit.
+ */
+int g_open_nvmm(uint16_t id, size_t len)
 {
-	nvmm_lineheader_t header ;
+	nvmm_off_t fragments ;
+	nvmm_off_t i ;
+	size_t span ;
+	int rc ;
 
-	header.id = 0xFFFF ;
-	header.len = len ;
-	header.delimiter = 0xFFFFFFFF ;
+	if(read_nvbytes == 0 || stream.opened)
+	{
+		return -1 ;
+	}
+	cache_drop(id) ;
+	if(group != id_group(id))
+	{//declared cold, written in the cold group.
+		use_group(id_group(id)) ;
+		rc = g_open_nvmm(id, len) ;
+		use_group(NVMM_GROUP_HOT) ;
+
+		return rc ;
+	}
+	if(!IS_LINEID_LEGAL(id) || len == 0 || len > page_size)
+	{
+		return -1 ;
+	}
+	bloom_id(id, 1) ;
 
-	write_words(pageid, offset + len, (uint8_t *)(&header), \
-				PAD_LENGTH(sizeof(nvmm_lineheader_t)) / sizeof(uint32_t));
-	write_words(pageid, offset, dat, len / sizeof(uint32_t));
+	//the fragments and the last line, without the last line header.
+	fragments = (len - 1) / fragment_len ;
+	span = (size_t)fragments * (fragment_len + header_slot) + PAD_LENGTH(len - (size_t)fragments * fragment_len) ;
+	if(reserve_line(span) != 0)
+	{
+		return -1 ;
+	}
 
+	stream.id = id ;
+	stream.offset = ctindex ;
+	stream.fragments = fragments ;
+	stream.datlen = len ;
+	stream.written = 0 ;
+	memset(stream.tail, 0xFF, sizeof(stream.tail)) ;
+	stream.compressed = 0 ;
+	stream.group = group ;
+	stream.opened = 1 ;
+
+	for(i=0;i<fragments;i++)
+	{
+		begin_line(activedpage, stream_offset(i * fragment_len), fragment_len) ;
+	}
+	begin_line(activedpage, stream_offset(i * fragment_len), len - i * fragment_len) ;
 
-	header.id = lineid ;
-	write_words(pageid, offset + len, (uint8_t *)(&header), \
-				PAD_LENGTH(sizeof(nvmm_lineheader_t)) / sizeof(uint32_t));
+	return 0 ;
+}
 
 
-	header.delimiter = NVMM_LINE_DELIMITER ;
-	write_words(pageid, offset + len, (uint8_t *)(&header), \
-				PAD_LENGTH(sizeof(nvmm_lineheader_t)) / sizeof(uint32_t));
-}
+/*
+ * append to the open NVMM stream.
+ * the data is programmed as soon as it fills program units, the rest waits for the next piece.
+ * return 0 if executed succeed, -1 if no stream is open or it's going over the length declared on open.
+ */
+int g_append_nvmm(const void* dat, size_t len)
+{
+	const uint8_t* piece = (const uint8_t* )dat ;
+	size_t fill ;
+	size_t full ;
+	uint8_t prev = group ;
+	int rc ;
+
+	if(stream.opened && stream.group != group)
+	{//the stream of a cold item.
+		use_group(stream.group) ;
+		rc = g_append_nvmm(dat, len) ;
+		use_group(prev) ;
+
+		return rc ;
+	}
+
+	if(!stream.opened || dat == 0 || len > stream.datlen - stream.written)
+	{
+		return -1 ;
+	}
+
+	//complete the unit left by the last piece.
+	fill = stream.written % program_unit ;
+	if(fill != 0)
+	{
+		full = (len < program_unit - fill)? len : program_unit - fill ;
+		memcpy(stream.tail + fill, piece, full) ;
+		piece += full ;
+		len -= full ;
+		stream.written += full ;
+		if(stream.written % program_unit != 0)
+		{
+			return 0 ;
+		}
+		write_words(activedpage, stream_offset(stream.written - program_unit), stream.tail, program_unit) ;
+		memset(stream.tail, 0xFF, sizeof(stream.tail)) ;
+	}
+
+	while(len >= program_unit)
+	{
+		full = len - len % program_unit ;
+		if(full > fragment_len - stream.written % fragment_len)
+		{//never program over a fragment line header.
+			full = fragment_len - stream.written % fragment_len ;
+		}
+		write_words(activedpage, stream_offset(stream.written), (uint8_t* )piece, full) ;
+		piece += full ;
+		len -= full ;
+		stream.written += full ;
+	}
+	memcpy(stream.tail, piece, len) ;
+	stream.written += len ;
 
+	return 0 ;
+}
 
 
 /*
- * initialize nvmm
- * need to call this method before using nvmm.
- * param read, write, erase are all flash operating methods. 
- * 		NVMM didn't realize them since the methods are platform dependent.
- *		You need to realize the 3methods in your Application layer or HAL.
- * 		The addresses in the 3methods are referring to base address 0, you should add the FLASH CHIP ADDRESS in your methods.
- * param flash_page_a and flash_page_b are the 2flash pages you assigned for the NVMM.
- * 		The parameters are flash page index, not the physical address of the flash memory.
- * 		For example, page0 means the 1st page in flash memory(Physical Address might be 0x00000000 + FLASH CHIP ADDRESS), 
- * 					suppose 2K bytes per page,
- *					page1 means the 2nd page in flash memory(Physical Address might be 0x00000800 + FLASH CHIP ADDRESS).
- *		Use 0xFFFF to leave the nvmm to use the default(PAGE A using page1 while PAGE B using page2).
- *		NOTE. You need to remove the pages assigned for nvmm from your compiler configuration, 
- *			or else, nvmm will confilits with your firmware image.
- * param flash_page_size is the page size of your flash, normally it based on the flash type you are using.
- *		Use 0xFFFF to leave the nvmm to use the default(2K bytes per page).
- * will return 0 for success executed, -1 for something error.
+ * close the NVMM stream.
+ * commit the value, it then replaces the former value of the id at once, the same as g_write_nvmm.
+ * closing before all the declared bytes are appended drops the value.
+ * return 0 if executed succeed, -1 if the value is dropped.
  */
-int g_init_nvmm(read_nvbytes_t read, write_nvwords_t write, erase_nvpage_t erase, \
-	uint16_t flash_page_a, uint16_t flash_page_b, uint16_t flash_page_size) 
+int g_close_nvmm(void)
 {
-	if(read == 0 || write == 0 || erase == 0)
+	nvmm_off_t last ;
+	nvmm_off_t len ;
+	nvmm_off_t i ;
+	uint8_t prev = group ;
+	int rc ;
+
+	if(stream.opened && stream.group != group)
+	{//the stream of a cold item.
+		use_group(stream.group) ;
+		rc = g_close_nvmm() ;
+		use_group(prev) ;
+
+		return rc ;
+	}
+
+	if(!stream.opened)
 	{
 		return -1 ;
 	}
-	
-	read_nvbytes = read ;
-	write_nvwords = write ;
-	erase_nvpage = erase ;
-	if(flash_page_a != 0xFFFF)
-	{
-		page_a_id = flash_page_a ;
+	stream.opened = 0 ;
+
+	if(stream.written != stream.datlen)
+	{//something might be programmed already, leave it to the next defrag.
+		tail_dirty = 1 ;
+		return -1 ;
 	}
-	if(flash_page_b != 0xFFFF)
+
+	if(stream.written % program_unit != 0)
 	{
-		page_b_id = flash_page_b ;
-	}	
-	if(flash_page_size != 0xFFFF)
+		write_words(activedpage, stream_offset(stream.written - stream.written % program_unit), \
+			stream.tail, program_unit) ;
+	}
+
+	//fragments first, the last line commits the whole value.
+	for(i=0;i<stream.fragments;i++)
 	{
-		page_size = flash_page_size ;
-	}	
-	
-	return check_nvmm() ;
+		commit_line(activedpage, stream_offset(i * fragment_len), stream.id, fragment_len, NVMM_FRAGMENT_DELIMITER) ;
+	}
+	last = stream_offset(i * fragment_len) ;
+	len = stream.datlen - i * fragment_len ;
+	commit_line(activedpage, last, stream.compressed? stream.id | NVMM_COMPRESSED_FLAG : stream.id, len, \
+		NVMM_LINE_DELIMITER) ;
+	cache_drop(stream.id) ;//a read while the stream was open kept the former value.
+
+	ctindex = last + PAD_LENGTH(len) + header_slot ;
+	checkpoint_line() ;
+	retain_save() ;
+
+	return 0 ;
 }
 
 
+
+
 /*
- * write NVMM
- * You need to specify an id, all read and write are based on the id later.
- * return 0 if executed succeed.
+ * report every line in the active page of the group in use to walk, from the latest written to the earliest.
+ * will return 0 for the whole page walked, 1 if stopped by walk, -1 if the page content is broken.
  */
-int g_write_nvmm(uint16_t id, size_t len, void* dat)
+static int walk_group(walk_nvmm_t walk, void* arg)
 {
-	size_t padded_len ;
-	uint16_t offset ;
-	uint8_t tmp ;
-	size_t i ;
-
-	offset = find_line_address(activedpage, ctindex, id);
+	nvmm_line_t lheader ;
+	nvmm_lineinfo_t line ;
+	nvmm_off_t offset ;
+	nvmm_off_t fragments ;
+	nvmm_off_t len ;
+	nvmm_reference_t ref ;
+	nvmm_off_t entries ;
+	uint32_t headers = 0 ;
+	uint32_t index_reads = 0 ;
+	
+	offset = ctindex - header_slot ;
 
-	if(offset > 0)
+	while(offset >= page_base)
 	{
-		for(i = 0; i < len; i++)
-		{
-			(* read_nvbytes)(FLASH_ADDRESS(activedpage, offset), &tmp, sizeof(tmp), sizeof(tmp)) ;
-			if(tmp != *((uint8_t *)dat + i))
+		if(read_line(activedpage, offset, &lheader) != 0)
+		{//broken content, the same as defrag_page.
+			return -1 ;
+		}
+		headers++ ;
+
+		if(IS_INDEX_DELIMITER(lheader.delimiter) && index_reads == 0)
+		{//lookups stop at the latest index line and binary search it, the same as find_line_address.
+			index_reads = headers ;
+			for(entries=lheader.len/sizeof(nvmm_index_t);entries>0;entries>>=1)
 			{
-				break ;
+				index_reads++ ;
 			}
-			offset++;
 		}
-
-		if (i == len)
-		{//no change.
-			return 0 ;
+		else if(IS_LINEID_LEGAL(lheader.id) && IS_LINEDELIMITER_LEGAL(lheader.delimiter))
+		{//a chunked value is reported as a whole, its fragments are skipped below.
+			fragments = count_fragments(activedpage, lheader.bottom, lheader.id, &len) ;
+			line.id = lheader.id ;
+			line.len = fragments * len + lheader.len ;
+			line.address = FLASH_ADDRESS(activedpage, (fragments > 0)? \
+						lheader.bottom - fragments * (len + header_slot) : lheader.data) ;
+			line.live = (find_line_address(activedpage, ctindex, lheader.id, 0) == lheader.data) ;
+			line.reference = read_reference(activedpage, &lheader, &ref) ;
+			line.compressed = lheader.compressed && !line.reference ;
+			line.indexed = (index_reads != 0) ;
+			line.reads = line.indexed? index_reads : headers - 1 ;
+			if((* walk)(&line, arg) != 0)
+			{//stopped by the caller.
+				return 1 ;
+			}
 		}
+		
+		offset = lheader.bottom - header_slot ;
 	}
 
-	padded_len = PAD_LENGTH(len) ;
+	return 0 ;
+}
+
+
+/*
+ * walk NVMM.
+ * report every line in the active page to walk, from the latest written to the earliest,
+ * the cold group follows the hot one if it's mounted.
+ * return 0 if executed succeed, -1 if the page content is broken.
+ */
+int g_walk_nvmm(walk_nvmm_t walk, void* arg)
+{
+	int rc ;
 
+	if(walk == 0)
+	{
+		return -1 ;
+	}
 
-	if(ctindex + padded_len + sizeof(nvmm_pageheader_t) > page_size)
+	rc = walk_group(walk, arg) ;
+	if(rc == 0 && cold_mounted)
 	{
-		dummy_activedpage() ;
-		defrag_page(activedpage) ;
+		use_group(NVMM_GROUP_COLD) ;
+		rc = walk_group(walk, arg) ;
+		use_group(NVMM_GROUP_HOT) ;
 	}
 
-  
-	write_line(activedpage, ctindex, id, padded_len, dat) ;
+	return (rc < 0)? -1 : 0 ;
+}
 
 
-	ctindex += padded_len + sizeof(nvmm_lineheader_t) ;
 
+/*
+ * get NVMM information.
+ * return 0 if executed succeed.
+ */
+int g_nvmm_info(nvmm_info_t* info)
+{
+	if(info == 0 || read_nvbytes == 0)
+	{
+		return -1 ;
+	}
+
+	info->active_page = activedpage ;
+	info->page_size = page_size ;
+	info->used = ctindex ;
+	info->free = page_size - ctindex ;
 
 	return 0 ;
 }
@@ -566,27 +4014,82 @@ int g_write_nvmm(uint16_t id, size_t len, void* dat)
 
 
 /*
- * read NVMM.
- * read NVMM item to specified buffer
+ * get NVMM wear, from the erase counts of the group and the write rate since it's mounted.
  * return 0 if executed succeed.
- * will also return -1 if reading a no- written item.
  */
-int g_read_nvmm(uint16_t id, size_t len, void *buf, size_t bufsize)
+int g_nvmm_wear(uint8_t cold, uint32_t endurance, nvmm_wear_t* wear)
 {
-	uint16_t offset ;
-	
-	if(buf == 0 || len == 0 || bufsize == 0 || bufsize < len)
+	uint32_t worst ;
+	uint32_t per_defrag ;
+
+	if(wear == 0 || read_nvbytes == 0 || (cold && !cold_mounted))
 	{
 		return -1 ;
 	}
-	
-	offset = find_line_address(activedpage, ctindex, id) ;
+	if(endurance == 0)
+	{
+		endurance = NVMM_ENDURANCE_DEFAULT ;
+	}
 
-	if (offset != 0)
+	use_group(cold? NVMM_GROUP_COLD : NVMM_GROUP_HOT) ;
+	wear->erases_a = (activedpage == page_a_id)? erases : spare_erases ;
+	wear->erases_b = (activedpage == page_a_id)? spare_erases : erases ;
+	worst = (erases > spare_erases)? erases : spare_erases ;
+	wear->remaining = (endurance > worst)? endurance - worst : 0 ;
+	wear->defrags = mount_defrags ;
+	wear->written = mount_written ;
+
+	//the pages take turns, the worst one is erased every other defrag.
+	per_defrag = (mount_defrags != 0)? mount_written / mount_defrags : 0 ;
+	if(mount_defrags == 0 || (per_defrag != 0 && wear->remaining > 0xFFFFFFFF / 2 / per_defrag))
 	{
-		(* read_nvbytes)(FLASH_ADDRESS(activedpage, offset), buf, bufsize, len) ;
-		return 0 ;
+		wear->projected = 0xFFFFFFFF ;
+	}
+	else
+	{
+		wear->projected = wear->remaining * 2 * per_defrag ;
+	}
+	use_group(NVMM_GROUP_HOT) ;
+
+	return 0 ;
+}
+
+
+/*
+ * get NVMM value cache hits.
+ * return 0 if executed succeed.
+ */
+int g_nvmm_cache(nvmm_cache_stat_t* stat)
+{
+	if(stat == 0 || cache == 0)
+	{
+		return -1 ;
 	}
-	return -1 ;
+
+	stat->hits = cache_hits ;
+	stat->misses = cache_misses ;
+
+	return 0 ;
 }
 
+
+/*
+ * defrag NVMM.
+ * move the latest lines to the other page and erase the current one.
+ * return 0 if executed succeed.
+ */
+int g_defrag_nvmm(void)
+{
+	int rc ;
+
+	if(read_nvbytes == 0 || stream.opened)
+	{
+		return -1 ;
+	}
+
+	dummy_activedpage() ;
+	rc = defrag_page(activedpage) ;
+	retain_save() ;
+
+	return rc ;
+}
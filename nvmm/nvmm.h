@@ -29,6 +29,26 @@
 #include <stdlib.h>
 
 
+/*
+ * NVMM address width, a build option.
+ * 16 keeps the compact layout, offsets and line lengths in a page are 16bits and a page is less than 64K bytes.
+ * 32 widens them to 32bits for 64K/128K bytes sectors(STM32F4/F7) or large files on Linux,
+ * the line header grows by 4bytes.
+ * Images built in one width can't be read in the other.
+ */
+#ifndef NVMM_ADDRESS_WIDTH
+#define NVMM_ADDRESS_WIDTH				16
+#endif
+
+#if (NVMM_ADDRESS_WIDTH == 32)
+typedef uint32_t nvmm_off_t ;
+#elif (NVMM_ADDRESS_WIDTH == 16)
+typedef uint16_t nvmm_off_t ;
+#else
+#error "NVMM_ADDRESS_WIDTH must be 16 or 32"
+#endif
+
+
 
 
 
@@ -39,6 +59,7 @@
 typedef int (* read_nvbytes_t)(uint32_t address, uint8_t* buf, size_t bufsize, size_t datlen) ;
 /*
  * write non-volatile memory WORDS function type.
+ * wordnum counts program units, a unit is a word(4bytes) unless nvmm_geometry_t.program_unit says otherwise.
  */
 typedef int (* write_nvwords_t)(uint32_t address, uint8_t* dat, size_t wordnum) ;
 /*
@@ -46,6 +67,24 @@ typedef int (* write_nvwords_t)(uint32_t address, uint8_t* dat, size_t wordnum)
  */
 typedef int (* erase_nvpage_t)(uint32_t address) ;
 
+/*
+ * a segment of a vectored read or program, len bytes at a flash address.
+ * a program segment is whole program units.
+ */
+typedef struct{
+	uint32_t address ;
+	uint8_t* buf ;
+	size_t len ;
+}nvmm_segment_t ;
+
+/*
+ * vectored read and program function types, num segments in one call.
+ * the segments must be carried out in the order given, a program done before the next one starts,
+ * a line is valid once its header is programmed and that must not happen ahead of its data.
+ */
+typedef int (* readv_nvbytes_t)(const nvmm_segment_t* segments, size_t num) ;
+typedef int (* writev_nvwords_t)(const nvmm_segment_t* segments, size_t num) ;
+
 /*
  * initialize nvmm
  * need to call this method before using nvmm.
@@ -68,20 +107,428 @@ typedef int (* erase_nvpage_t)(uint32_t address) ;
 int g_init_nvmm(read_nvbytes_t read, write_nvwords_t write, erase_nvpage_t erase, \
 	uint16_t flash_page_a, uint16_t flash_page_b, uint16_t flash_page_size) ;
 
+
+/*
+ * NVMM flash geometry.
+ * MCU internal flash erases and programs the same page, so g_init_nvmm is enough.
+ * External SPI NOR flash normally erases 4K bytes sectors but programs 256 bytes pages, 
+ * an nvmm page may also span several erase sectors to hold more lines.
+ */
+typedef struct{
+	uint32_t page_size ;			//nvmm page size, flash_page_a and flash_page_b are in this unit. 0xFFFF for the default(2K bytes).
+									//less than 64K bytes unless NVMM_ADDRESS_WIDTH is 32.
+	uint32_t erase_size ;			//erase unit, erase_nvpage is called once per erase unit. page_size must be a multiple of it.
+									//0 for the same as page_size.
+	uint32_t program_page_size ;	//a write_nvwords call never crosses a program page boundary and 
+									//copying is batched up to the boundaries. 0 for no program page.
+	uint32_t program_unit ;			//bytes of one flash program, 2 for half word(STM32F1), 8 for double word(STM32L4/G4),
+									//32 for flash word(STM32H7). 0 for the default word(4bytes).
+									//lines are padded to it, and flash programming more than a word at a time
+									//can't program a unit twice, nvmm then writes every unit only once.
+	uint32_t header_format ;		//line header format of the pages nvmm creates, NVMM_HEADER_STANDARD or NVMM_HEADER_COMPACT.
+}nvmm_geometry_t ;
+
+/*
+ * line header formats.
+ * the compact one packs a line header in a word(12bits id, 12bits length and 8bits checksum) instead of 8 bytes,
+ * it's for program units up to a word, and ids below 0xFFF. a line holds up to 4K bytes, longer items are chunked.
+ * every page tells its own format, a page of the other format is still read and written,
+ * and it's converted to the configured format on the next defrag if all the items fit in it.
+ */
+#define NVMM_HEADER_STANDARD		0
+#define NVMM_HEADER_COMPACT			1
+
+/*
+ * initialize nvmm with the flash geometry.
+ * the same as g_init_nvmm, but for flash whose erase unit or program page differs from the nvmm page,
+ * such as external SPI NOR flash.
+ * erase_nvpage gets the address of every erase unit in the page.
+ * will return 0 for success executed, -1 for something error.
+ */
+int g_init_nvmm_geometry(read_nvbytes_t read, write_nvwords_t write, erase_nvpage_t erase, \
+	uint16_t flash_page_a, uint16_t flash_page_b, const nvmm_geometry_t* geometry) ;
+
 /*
  * write NVMM
  * You need to specify an id, all read and write are based on the id later.
+ * an item longer than a line(32K bytes unless NVMM_ADDRESS_WIDTH is 32) is chunked into fragments, 
+ * it's still committed at once and reading it is transparent. 
+ * an item of 4 bytes or less(up to 24 bytes with 32 bytes program unit) is kept inline in the line header.
+ * all the items must fit in one page anyway, since the other page is kept for defrag.
+ * ids are below 0x8000, or below 0xFFF on a page of compact line headers.
+ * an item is compressed if g_compress_nvmm gives it a level and it gets shorter,
+ * or it's a reference to a line holding the same value if g_dedup_nvmm is on.
  * return 0 if executed succeed.
  */
 int g_write_nvmm(uint16_t id, size_t len, void* dat) ;
 
 
+/*
+ * compression level callback function type.
+ * return the level to compress the item of id with, NVMM_COMPRESS_NONE to store it as it is.
+ * a higher level searches further back for repeated bytes, it compresses better but writes slower,
+ * reading costs the same whatever the level.
+ */
+typedef uint8_t (* compress_nvmm_t)(uint16_t id, size_t len) ;
+
+#define NVMM_COMPRESS_NONE			0
+#define NVMM_COMPRESS_FAST			1
+#define NVMM_COMPRESS_BEST			8
+
+/*
+ * compress NVMM items.
+ * set the callback telling the compression level of every item written by g_write_nvmm, 0 to turn it off.
+ * items of 32 bytes or less and items written by the stream are never compressed.
+ * reading a compressed item is transparent, it's decompressed with about 400 bytes of stack,
+ * g_nvmm_size and the read length are the ones before compression.
+ * return 0 if executed succeed.
+ */
+int g_compress_nvmm(compress_nvmm_t level) ;
+
+
+/*
+ * deduplicate NVMM items.
+ * with enable set, g_write_nvmm looks for a line already holding the same value, of any id,
+ * and writes a 12 bytes reference to it instead of the value.
+ * a defrag keeps the references, the value of a superseded line is kept once for all of them.
+ * items of 32 bytes or less and items written by the stream are never deduplicated.
+ * it takes a scan of the page, comparing the values of the same length, on every write.
+ * return 0 if executed succeed.
+ */
+int g_dedup_nvmm(uint8_t enable) ;
+
+
+/*
+ * checksum callback function type.
+ * return the checksum of len bytes of dat.
+ */
+typedef uint32_t (* checksum_nvmm_t)(const uint8_t* dat, size_t len) ;
+
+/*
+ * set the checksum nvmm takes of the values it dedups and of the retained mount state, for example the MCU CRC unit.
+ * a write over a reference compares the checksum of the new value with the one the reference keeps first,
+ * and reads the stored value only if they match.
+ * the default is the one of the STM32 CRC unit in software by a small table: CRC-32, polynomial 0x04C11DB7, 
+ * initial 0xFFFFFFFF, no reflection and no final xor, over dat as little endian words, the last word padded with 0.
+ * a hook should give the same, the checksums of the references are kept in the flash and images are built on host.
+ * a reference of another checksum is still read right, a write of the same value just doesn't find it by the checksum.
+ * 0 for the software default, that's the default.
+ * return 0 if executed succeed.
+ */
+int g_checksum_nvmm(checksum_nvmm_t checksum) ;
+
+
+/*
+ * set index checkpoints.
+ * with lines set, an index line is appended every lines items written, merging the index below with the lines since,
+ * so a lookup walks down no more than lines lines before it binary searches the index.
+ * a checkpoint takes 4 bytes(8 bytes with 32 bits width) for every id and the time of reading the index below it.
+ * 0 for the index written by a defrag only, that's the default.
+ * mounting counts the lines since the last index, walking down no more than lines lines.
+ * return 0 if executed succeed.
+ */
+int g_checkpoint_nvmm(size_t lines) ;
+
+
+/*
+ * set a bloom filter of the ids written.
+ * bits are size bytes of RAM kept by the caller, the filter is built on every mount and set on every write,
+ * so reading an id never written returns -1 without touching the flash, instead of walking down the whole page.
+ * about 10 bits for every id written keep the ids looked up in vain to 2 percent.
+ * building it walks down to the index line of each group and reads the entries of the index.
+ * 0 size for no filter, that's the default.
+ * return 0 if executed succeed.
+ */
+int g_bloom_nvmm(uint8_t* bits, size_t size) ;
+
+
+/*
+ * NVMM value cache entry, a build option sets the longest value cached.
+ */
+#ifndef NVMM_CACHE_VALUE_MAX
+#define NVMM_CACHE_VALUE_MAX			16
+#endif
+
+typedef struct{
+	uint16_t id ;
+	uint16_t len ;
+	uint32_t used ;		//the time of the last hit, 0 for an empty entry.
+	uint8_t value[NVMM_CACHE_VALUE_MAX] ;
+}nvmm_cache_t ;
+
+/*
+ * set the value cache.
+ * entries are num entries of RAM kept by the caller, items of NVMM_CACHE_VALUE_MAX bytes or less
+ * read whole by g_read_nvmm or g_read_nvmm_len are kept there, the least recently used one is dropped for a new one.
+ * g_read_nvmm, g_read_nvmm_len, g_read_nvmm_at and g_nvmm_size of a cached item don't touch the flash.
+ * writing an item drops it, a defrag keeps the values so the cache is kept as well.
+ * 0 num for no cache, that's the default. the entries and the hit counts are cleared.
+ * return 0 if executed succeed.
+ */
+int g_cache_nvmm(nvmm_cache_t* entries, size_t num) ;
+
+
+/*
+ * set a RAM shadow of the active page.
+ * ram is size bytes kept by the caller, at least a page. the active page of the pages given to g_init_nvmm
+ * is copied there on every mount and after every defrag, and kept in step with every program,
+ * so lookups, reads, compares and defrag copies are served from RAM and the flash is only programmed and erased.
+ * programs are still verified against the flash.
+ * fill copies a page to the shadow, for example by DMA, 0 to copy it with the read function given to g_init_nvmm.
+ * 0 size for no shadow, that's the default.
+ * return 0 if executed succeed.
+ */
+int g_shadow_nvmm(uint8_t* ram, size_t size, read_nvbytes_t fill) ;
+
+
+/*
+ * NVMM retained mount state, placed in RAM the startup code leaves alone over a reset, such as a .noinit section.
+ */
+#define NVMM_RETAIN_WORDS				32
+
+typedef struct{
+	uint32_t mark ;
+	uint32_t check ;
+	uint32_t state[NVMM_RETAIN_WORDS] ;	//private to nvmm.
+}nvmm_retain_t ;
+
+/*
+ * set the retained RAM of the mount state, call it before g_init_nvmm.
+ * the mount state is kept there after every write, defrag and mount, and marked out of date before programming.
+ * g_init_nvmm and g_init_nvmm_cold take it instead of scanning the pages if its checksum holds,
+ * the geometry is the same and the page state words still agree with it, a warm reset then mounts at once.
+ * a cold boot, a reset in the middle of programming or pages changed by something else mount from the flash as usual.
+ * 0 for mounting from the flash every time, that's the default.
+ * return 0 if executed succeed.
+ */
+int g_retain_nvmm(nvmm_retain_t* block) ;
+
+
+/*
+ * set a readahead window for the header scans.
+ * ram is size bytes kept by the caller, 64 to 256 bytes suit most SPI flash.
+ * the mount, the lookups and the defrag walk the line headers down the page, a header not in the window
+ * refills it with the size bytes ending at the header, so the headers and the values below it come with one read
+ * instead of one read each. the window is kept in step with every program and erase.
+ * it pays where every read has a command overhead, on internal flash or with a shadow of the page it saves nothing.
+ * 0 size for reading every header alone, that's the default.
+ * return 0 if executed succeed.
+ */
+int g_scan_nvmm(uint8_t* ram, size_t size) ;
+
+
+/*
+ * set the vectored flash methods, the scalar ones given to g_init_nvmm are still needed.
+ * with writev, the programs of a line, the length, the data, the padded tail and the header stages, 
+ * are collected and handed over in one call, then read back in one readv call to verify. the driver may pipeline them
+ * by DMA or queued SPI transfers. a line longer than the collecting buffer(a build option) goes in more calls.
+ * readv 0 reads the programs back with the scalar read method.
+ * 0 writev for programming every piece with the scalar write method, that's the default.
+ * return 0 if executed succeed, -1 if readv is given without writev.
+ */
+int g_vector_nvmm(readv_nvbytes_t readv, writev_nvwords_t writev) ;
+
+
+/*
+ * classify callback function type.
+ * return the class of the item of id, it must be the same every time for an id.
+ */
+typedef uint8_t (* classify_nvmm_t)(uint16_t id) ;
+
+#define NVMM_CLASS_AUTO				0	//moved to the cold group once it's not written between two defrags.
+#define NVMM_CLASS_HOT				1	//always kept in the hot group.
+#define NVMM_CLASS_COLD				2	//written straight to the cold group.
+
+/*
+ * mount the cold page group.
+ * flash_page_a and flash_page_b are another two pages of the same geometry, erased or holding a cold group,
+ * the pages given to g_init_nvmm are the hot group.
+ * items rarely written are kept in the cold group, so the hot group is defragged less often
+ * and doesn't copy them again on every defrag. classify tells the class of an item, 0 to take all of them as auto.
+ * reading takes the group of the class first, then the other one.
+ * call it after every g_init_nvmm, g_nvmm_info and g_defrag_nvmm keep reporting and defragging the hot group.
+ * return 0 if executed succeed.
+ */
+int g_init_nvmm_cold(uint16_t flash_page_a, uint16_t flash_page_b, classify_nvmm_t classify) ;
+
+
 /*
  * read NVMM.
  * read NVMM item to specified buffer
  * return 0 if executed succeed.
- * will also return -1 if reading a no- written item.
+ * will also return -1 if reading a no- written item or len is over the stored length.
  */
 int g_read_nvmm(uint16_t id, size_t len, void *buf, size_t bufsize) ;
 
+
+/*
+ * read a whole NVMM item and get the length it was written with.
+ * return 0 if executed succeed.
+ * will also return -1 if reading a no- written item or bufsize is less than the item, 
+ * len still gets the item length then, so the caller can get a buffer large enough.
+ */
+int g_read_nvmm_len(uint16_t id, void* buf, size_t bufsize, size_t* len) ;
+
+
+/*
+ * get the length of a NVMM item, the same as it was written with.
+ * return the length, -1 for a no- written item.
+ */
+long g_nvmm_size(uint16_t id) ;
+
+
+/*
+ * read NVMM at an offset.
+ * read len bytes from offset inside the item, only those bytes are read from flash,
+ * for getting an entry from a large table.
+ * return 0 if executed succeed.
+ * will also return -1 if reading a no- written item or reading over the item.
+ */
+int g_read_nvmm_at(uint16_t id, size_t offset, size_t len, void* buf, size_t bufsize) ;
+
+
+/*
+ * NVMM read cursor, for reading a large item in chunks.
+ */
+typedef struct{
+	uint32_t address ;		//next byte to read, referring to base address 0 as the flash methods.
+	uint32_t left ;			//bytes left in the item.
+	uint32_t fragment_left ;	//nvmm internal, bytes left in the current fragment of a chunked item.
+	uint32_t fragment_len ;	//nvmm internal.
+	uint32_t header_slot ;	//nvmm internal.
+	uint32_t generation ;	//nvmm internal, tells the cursor out of date.
+	uint32_t compressed ;	//nvmm internal, compressed bytes of a compressed item, 0 for others.
+	uint32_t position ;		//nvmm internal, bytes read so far of a compressed item.
+}nvmm_cursor_t ;
+
+/*
+ * open a read cursor at offset inside the item, the item is looked up only once here.
+ * return 0 if executed succeed.
+ * will also return -1 if it's a no- written item or the offset is over the item.
+ */
+int g_open_nvmm_cursor(nvmm_cursor_t* cursor, uint16_t id, size_t offset) ;
+
+/*
+ * read the next len bytes from the cursor.
+ * a compressed item is decompressed from its start on every read, read it in large chunks.
+ * the cursor keeps reading the item as it was when opened, even if the item is written again later.
+ * it's out of date once nvmm defrags(g_write_nvmm may defrag), open it again then.
+ * return 0 if executed succeed.
+ * will also return -1 if reading over the item or the cursor is out of date.
+ */
+int g_read_nvmm_cursor(nvmm_cursor_t* cursor, void* buf, size_t len) ;
+
+
+/*
+ * streaming write NVMM.
+ * write a line in pieces as they're produced, for values too large to be buffered in RAM.
+ * g_open_nvmm declares the id and the whole length, g_append_nvmm programs the pieces,
+ * and g_close_nvmm commits the line, it's atomic the same as g_write_nvmm, 
+ * readers see the former line of the id until the stream is closed, powering off before that drops the stream.
+ * only one stream at a time, g_write_nvmm and g_defrag_nvmm fail while a stream is open.
+ * all return 0 if executed succeed.
+ */
+int g_open_nvmm(uint16_t id, size_t len) ;
+int g_append_nvmm(const void* dat, size_t len) ;
+int g_close_nvmm(void) ;
+
+
+/*
+ * NVMM line information, reported by g_walk_nvmm.
+ */
+typedef struct{
+	uint16_t id ;
+	uint32_t len ;		//stored length, the same as written. the whole length for an item chunked into fragments.
+	uint32_t address ;	//address of the line data, referring to base address 0 as the flash methods.
+						//a chunked item starts there but has a fragment line header every fragment.
+	uint8_t live ;		//1 for the latest line of the id, 0 for a superseded one.
+	uint8_t compressed ;	//1 for a compressed item, len is the compressed length then.
+	uint8_t reference ;		//1 for a reference to a line holding the same value, len is the reference length then.
+	uint8_t indexed ;		//1 if a lookup finds the line by a binary search of the index line above it.
+	uint32_t reads ;		//line headers and index entries a lookup reads in the group before it gets to the line,
+							//the same for all the indexed lines of a group.
+}nvmm_lineinfo_t ;
+
+/*
+ * walk callback function type.
+ * return 0 to go on walking, others to stop.
+ */
+typedef int (* walk_nvmm_t)(const nvmm_lineinfo_t* line, void* arg) ;
+
+/*
+ * walk NVMM.
+ * report every line in the active page to walk, from the latest written to the earliest,
+ * the lines of the cold group follow if it's mounted, a line is live inside its own group.
+ * it's slow, for diagnostic and tools only.
+ * return 0 if executed succeed, -1 if the page content is broken.
+ */
+int g_walk_nvmm(walk_nvmm_t walk, void* arg) ;
+
+
+/*
+ * NVMM information.
+ */
+typedef struct{
+	uint32_t active_page ;
+	uint32_t page_size ;
+	uint32_t used ;		//bytes used in the active page, page header included.
+	uint32_t free ;		//bytes left for new lines before the next defrag.
+}nvmm_info_t ;
+
+/*
+ * get NVMM information.
+ * return 0 if executed succeed.
+ */
+int g_nvmm_info(nvmm_info_t* info) ;
+
+
+/*
+ * NVMM wear.
+ * the erase counts are kept in the page headers from the time nvmm formats the pages,
+ * pages written by an older nvmm start counting at their next defrag.
+ */
+typedef struct{
+	uint32_t erases_a ;		//erases of page A.
+	uint32_t erases_b ;		//erases of page B.
+	uint32_t remaining ;	//erases left to the most worn page before the endurance, 0 if it's worn out.
+	uint32_t defrags ;		//defrags since g_init_nvmm.
+	uint32_t written ;		//bytes of lines written since g_init_nvmm, headers and padding included.
+	uint32_t projected ;	//bytes that can still be written at the rate since g_init_nvmm, 
+							//0xFFFFFFFF for more or before the first defrag.
+}nvmm_wear_t ;
+
+/*
+ * get NVMM wear.
+ * param cold is set for the cold group, 0 for the pages given to g_init_nvmm.
+ * param endurance is the rated erase cycles of the flash, 0 for the default(10000).
+ * the two pages of a group take turns, so they wear evenly and a group lasts about 2 * endurance defrags.
+ * return 0 if executed succeed.
+ */
+int g_nvmm_wear(uint8_t cold, uint32_t endurance, nvmm_wear_t* wear) ;
+
+
+/*
+ * NVMM value cache hits, for sizing the cache.
+ */
+typedef struct{
+	uint32_t hits ;		//reads served from the cache.
+	uint32_t misses ;	//reads of items not in the cache.
+}nvmm_cache_stat_t ;
+
+/*
+ * get NVMM value cache hits since g_cache_nvmm.
+ * return 0 if executed succeed, -1 if there's no cache.
+ */
+int g_nvmm_cache(nvmm_cache_stat_t* stat) ;
+
+
+/*
+ * defrag NVMM.
+ * move the latest lines to the other page and erase the current one.
+ * normally nvmm defrags by itself when the page is full, 
+ * call it on idle time to avoid the defrag delay in g_write_nvmm.
+ * return 0 if executed succeed.
+ */
+int g_defrag_nvmm(void) ;
+
 #endif /* NVMM.H */
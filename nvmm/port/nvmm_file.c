@@ -0,0 +1,223 @@
+/*
+ * File Name: nvmm_file.c
+ * Author: PROJECTSUGAR
+ * Description: 
+ * File backed flash methods for running NVMM on Linux.
+     Copyright 2017 PROJECTSUGAR
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include "nvmm_file.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define NVMM_FILE_WORD_SIZE				4
+#define NVMM_FILE_WORD_BATCH			64		//words merged on stack per pwrite.
+
+static int fd = -1 ;
+static uint8_t* map = 0 ;
+static uint32_t map_base = 0 ;
+static uint32_t map_size = 0 ;
+static uint32_t erase_size = 0 ;
+static uint32_t program_unit = NVMM_FILE_WORD_SIZE ;
+static int sync_writes = 0 ;
+
+
+#define IS_RANGE_LEGAL(address, len)	((address) >= map_base && (address) - map_base + (len) <= map_size)
+
+
+/*
+ * flush the programmed range to the storage.
+ */
+static int flush_range(uint32_t offset, size_t len)
+{
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE) ;
+	uintptr_t start = ((uintptr_t)map + offset) & ~(page - 1) ;
+
+	if(!sync_writes)
+	{
+		return 0 ;
+	}
+
+	return msync((void* )start, (uintptr_t)map + offset + len - start, MS_SYNC) ;
+}
+
+
+int nvmm_file_open(const char* path, uint32_t base_address, uint32_t size, uint32_t page_size, uint32_t unit, int sync)
+{
+	struct stat st ;
+	uint8_t blank[NVMM_FILE_WORD_SIZE * NVMM_FILE_WORD_BATCH] ;
+	uint32_t offset ;
+	size_t len ;
+
+	nvmm_file_close() ;
+
+	if(unit == 0)
+	{
+		unit = NVMM_FILE_WORD_SIZE ;
+	}
+	if(path == 0 || size == 0 || page_size == 0 || size % page_size || page_size % unit || sizeof(blank) % unit)
+	{
+		return -1 ;
+	}
+
+	fd = open(path, O_RDWR | O_CREAT, 0644) ;
+	if(fd < 0 || fstat(fd, &st) != 0)
+	{
+		nvmm_file_close() ;
+		return -1 ;
+	}
+
+	//a new or short file is extended with erased bytes.
+	memset(blank, 0xFF, sizeof(blank)) ;
+	for(offset=st.st_size;offset<size;offset+=len)
+	{
+		len = (size - offset < sizeof(blank))? size - offset : sizeof(blank) ;
+		if(pwrite(fd, blank, len, offset) != (ssize_t)len)
+		{
+			nvmm_file_close() ;
+			return -1 ;
+		}
+	}
+	if(fsync(fd) != 0)
+	{
+		nvmm_file_close() ;
+		return -1 ;
+	}
+
+	map = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0) ;
+	if(map == MAP_FAILED)
+	{
+		map = 0 ;
+		nvmm_file_close() ;
+		return -1 ;
+	}
+
+	map_base = base_address ;
+	map_size = size ;
+	erase_size = page_size ;
+	program_unit = unit ;
+	sync_writes = sync ;
+
+	return 0 ;
+}
+
+
+void nvmm_file_close(void)
+{
+	if(map != 0)
+	{
+		msync(map, map_size, MS_SYNC) ;
+		munmap(map, map_size) ;
+		map = 0 ;
+	}
+	if(fd >= 0)
+	{
+		close(fd) ;
+		fd = -1 ;
+	}
+	map_size = 0 ;
+}
+
+
+/*
+ * fast path, the file is mapped so reading is a plain copy.
+ */
+int nvmm_file_read(uint32_t address, uint8_t* buf, size_t bufsize, size_t datlen)
+{
+	if(buf == 0 || bufsize == 0 || datlen == 0 || bufsize < datlen)
+	{
+		return -1 ;
+	}
+	if(map == 0 || !IS_RANGE_LEGAL(address, datlen))
+	{
+		return -1 ;
+	}
+
+	memcpy(buf, map + address - map_base, datlen) ;
+
+	return 0 ;
+}
+
+
+int nvmm_file_write(uint32_t address, uint8_t* dat, size_t wordnum)
+{
+	uint8_t words[NVMM_FILE_WORD_SIZE * NVMM_FILE_WORD_BATCH] ;
+	uint32_t offset ;
+	size_t len ;
+	size_t total ;
+	size_t i ;
+
+	if(dat == 0 || wordnum == 0 || address % program_unit)
+	{
+		return -1 ;
+	}
+	if(map == 0 || !IS_RANGE_LEGAL(address, wordnum * program_unit))
+	{
+		return -1 ;
+	}
+
+	offset = address - map_base ;
+	total = wordnum * program_unit ;
+	while(total > 0)
+	{
+		len = (total < sizeof(words))? total : sizeof(words) ;
+
+		//NOR programming, bits can only go from 1 to 0.
+		for(i=0;i<len;i++)
+		{
+			words[i] = map[offset + i] & dat[i] ;
+		}
+		if(pwrite(fd, words, len, offset) != (ssize_t)len)
+		{
+			return -1 ;
+		}
+
+		offset += len ;
+		dat += len ;
+		total -= len ;
+	}
+
+	return flush_range(address - map_base, wordnum * program_unit) ;
+}
+
+
+int nvmm_file_erase(uint32_t address)
+{
+	uint8_t blank[NVMM_FILE_WORD_SIZE * NVMM_FILE_WORD_BATCH] ;
+	uint32_t offset ;
+	size_t len ;
+
+	if(map == 0 || !IS_RANGE_LEGAL(address, erase_size) || (address - map_base) % erase_size)
+	{
+		return -1 ;
+	}
+
+	memset(blank, 0xFF, sizeof(blank)) ;
+	for(offset=0;offset<erase_size;offset+=len)
+	{
+		len = (erase_size - offset < sizeof(blank))? erase_size - offset : sizeof(blank) ;
+		if(pwrite(fd, blank, len, address - map_base + offset) != (ssize_t)len)
+		{
+			return -1 ;
+		}
+	}
+
+	return flush_range(address - map_base, erase_size) ;
+}
@@ -0,0 +1,61 @@
+/*
+ * File Name: nvmm_file.h
+ * Author: PROJECTSUGAR
+ * Description: 
+ * File backed flash methods for running NVMM on Linux.
+ * The NVMM pages are kept in a regular file with the same layout as on the MCU flash,
+ * so parameter images can be shared between the MCUs and the gateways.
+ * Reads go through a shared mmap of the file, programs and erases go through pwrite and are flushed by msync.
+ * Atomicity follows the flash model NVMM is designed for:
+ * 		a program can only clear bits(it's ANDed with the current content like a NOR flash),
+ * 		programs are pwrites aligned to the program unit, a unit never straddles a storage sector, so it's either done or not done after a power loss,
+ * 		an erase may be interrupted half way, NVMM formats such a page again on the next g_init_nvmm.
+ * Note. The methods keep the file in static variables, only one file is supported, the same as nvmm itself.
+     Copyright 2017 PROJECTSUGAR
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef __NVMM_FILE_H__
+#define __NVMM_FILE_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * open the flash file.
+ * param path is the file, it's created and filled with 0xFF(erased) if it doesn't exist.
+ * param base_address is the flash address the file starts with,
+ *		pass page_a * page_size if the NVMM pages are page_a and page_a + 1, so no file space is wasted for pages before.
+ * param size is the file size, it must hold all the NVMM pages.
+ * param page_size is the erase unit, the same page size passed to g_init_nvmm.
+ * param unit is the program unit in bytes, the same program_unit given in nvmm_geometry_t, 0 for a word.
+ *		wordnum of nvmm_file_write counts these units.
+ * param sync, none 0 to msync every program and erase before returning, 
+ *		0 to leave the flushing to the kernel, faster but a power loss may lose the latest writes.
+ * will return 0 for success, -1 for something error.
+ */
+int nvmm_file_open(const char* path, uint32_t base_address, uint32_t size, uint32_t page_size, uint32_t unit, int sync) ;
+
+/*
+ * flush and close the flash file.
+ */
+void nvmm_file_close(void) ;
+
+/*
+ * NVMM flash operating methods, pass them to g_init_nvmm.
+ */
+int nvmm_file_read(uint32_t address, uint8_t* buf, size_t bufsize, size_t datlen) ;
+int nvmm_file_write(uint32_t address, uint8_t* dat, size_t wordnum) ;
+int nvmm_file_erase(uint32_t address) ;
+
+#endif /* NVMM_FILE.H */
@@ -46,6 +46,7 @@
 
 /* Private variables ---------------------------------------------------------*/
 UART_HandleTypeDef huart1;
+DMA_HandleTypeDef hdma_memtomem_dma1_channel1;
 
 /* USER CODE BEGIN PV */
 /* Private variables ---------------------------------------------------------*/
@@ -55,6 +56,7 @@ UART_HandleTypeDef huart1;
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_USART1_UART_Init(void);
 
 /* USER CODE BEGIN PFP */
@@ -266,7 +268,56 @@ static int erase_nvpage(uint32_t address)
 	return 0 ;
 }
 
+
+/*
+ * fill the nvmm shadow with a page by DMA memory to memory, word by word.
+ */
+static int fill_shadow(uint32_t address, uint8_t* buf, size_t bufsize, size_t datlen)
+{
+	if(address + FLASH_BASE_ADDRESS + datlen > FLASH_MAX_ADDRESS || bufsize < datlen || datlen % 4)
+	{
+		return -1 ;
+	}
+
+	if(HAL_OK != HAL_DMA_Start(&hdma_memtomem_dma1_channel1, address + FLASH_BASE_ADDRESS, (uint32_t)buf, datlen / 4) || \
+		HAL_OK != HAL_DMA_PollForTransfer(&hdma_memtomem_dma1_channel1, HAL_DMA_FULL_TRANSFER, HAL_MAX_DELAY))
+	{
+		return -1 ;
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * nvmm checksum by the CRC unit, driven through its registers.
+ * the unit takes words only, the tail goes in a word padded with 0 the same as nvmm's software CRC.
+ */
+static uint32_t crc_checksum(const uint8_t* dat, size_t len)
+{
+	uint32_t word ;
+
+	CRC->CR = CRC_CR_RESET ;
+	for(;len>=sizeof(uint32_t);len-=sizeof(uint32_t))
+	{
+		memcpy(&word, dat, sizeof(uint32_t)) ;	//dat needn't be word aligned.
+		CRC->DR = word ;
+		dat += sizeof(uint32_t) ;
+	}
+	if(len > 0)
+	{
+		word = 0 ;
+		memcpy(&word, dat, len) ;
+		CRC->DR = word ;
+	}
+
+	return CRC->DR ;
+}
+
 int nvmm_buf[1024] = {0, } ;
+uint8_t nvmm_bloom[32] = {0, } ;		//10 bits for each of about 25 ids.
+uint32_t nvmm_shadow[FLASH_PAGE_SIZE / 4] = {0, } ;	//word aligned for the DMA.
+nvmm_retain_t nvmm_retain __attribute__((section(".noinit"))) ;	//the mount state over a warm reset.
 /* USER CODE END 0 */
 
 int main(void)
@@ -274,6 +325,7 @@ int main(void)
 
   /* USER CODE BEGIN 1 */
 	volatile int rc = -1 ;
+	size_t len = 0 ;
   /* USER CODE END 1 */
 
   /* MCU Configuration----------------------------------------------------------*/
@@ -294,24 +346,30 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_USART1_UART_Init();
 
   /* USER CODE BEGIN 2 */
 	
+	__HAL_RCC_CRC_CLK_ENABLE() ;
+	rc = g_checksum_nvmm(crc_checksum) ;		//before the retained state is checked.
+	rc = g_retain_nvmm(&nvmm_retain) ;
 	rc = g_init_nvmm(read_nvbytes, write_nvwords, erase_nvpage, \
 				FLASH_NVMM_PAGEA, FLASH_NVMM_PAGEB, FLASH_PAGE_SIZE) ;
-	rc = g_read_nvmm(0, 30, nvmm_buf, sizeof(nvmm_buf)) ;
+	rc = g_bloom_nvmm(nvmm_bloom, sizeof(nvmm_bloom)) ;
+	rc = g_shadow_nvmm((uint8_t* )nvmm_shadow, sizeof(nvmm_shadow), fill_shadow) ;
+	rc = g_read_nvmm_len(0, nvmm_buf, sizeof(nvmm_buf), &len) ;
 	rc = g_write_nvmm(0, strlen("Hello NVMM!"), "Hello NVMM!") ;
-	rc = g_read_nvmm(0, 30, nvmm_buf, sizeof(nvmm_buf)) ;
+	rc = g_read_nvmm_len(0, nvmm_buf, sizeof(nvmm_buf), &len) ;
 
 	rc = g_write_nvmm(1, strlen("1Hello NVMM!"), "1Hello NVMM!") ;
-	rc = g_read_nvmm(1, 30, nvmm_buf, sizeof(nvmm_buf)) ;
+	rc = g_read_nvmm_len(1, nvmm_buf, sizeof(nvmm_buf), &len) ;
 
 	rc = g_write_nvmm(0, strlen("2Hello NVMM!"), "2Hello NVMM!") ;
-	rc = g_read_nvmm(0, 30, nvmm_buf, sizeof(nvmm_buf)) ;
+	rc = g_read_nvmm_len(0, nvmm_buf, sizeof(nvmm_buf), &len) ;
 
 	rc = g_write_nvmm(0, strlen("3Hello NVMM!"), "3Hello NVMM!") ;
-	rc = g_read_nvmm(0, 30, nvmm_buf, sizeof(nvmm_buf)) ;
+	rc = g_read_nvmm_len(0, nvmm_buf, sizeof(nvmm_buf), &len) ;
 
   /* USER CODE END 2 */
 
@@ -392,6 +450,32 @@ static void MX_USART1_UART_Init(void)
 
 }
 
+/** 
+  * Enable DMA controller clock
+  * Configure DMA for memory to memory transfers
+  *   hdma_memtomem_dma1_channel1
+  */
+static void MX_DMA_Init(void) 
+{
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* Configure DMA request hdma_memtomem_dma1_channel1 on DMA1_Channel1 */
+  hdma_memtomem_dma1_channel1.Instance = DMA1_Channel1;
+  hdma_memtomem_dma1_channel1.Init.Direction = DMA_MEMORY_TO_MEMORY;
+  hdma_memtomem_dma1_channel1.Init.PeriphInc = DMA_PINC_ENABLE;
+  hdma_memtomem_dma1_channel1.Init.MemInc = DMA_MINC_ENABLE;
+  hdma_memtomem_dma1_channel1.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+  hdma_memtomem_dma1_channel1.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+  hdma_memtomem_dma1_channel1.Init.Mode = DMA_NORMAL;
+  hdma_memtomem_dma1_channel1.Init.Priority = DMA_PRIORITY_LOW;
+  if (HAL_DMA_Init(&hdma_memtomem_dma1_channel1) != HAL_OK)
+  {
+    _Error_Handler(__FILE__, __LINE__);
+  }
+
+}
+
 /** Configure pins as 
         * Analog 
         * Input 
@@ -0,0 +1,430 @@
+/*
+ * File Name: nvmm_bench.c
+ * Author: PROJECTSUGAR
+ * Description:
+ * NVMM host benchmark.
+ * file backend(default):
+ * 		measures the per call cost of g_write_nvmm and g_read_nvmm running on the Linux file backend(port/nvmm_file.c),
+ * 		against a plain key-value file where every id owns a fixed slot updated in place by pwrite.
+ * spinor backend(-b spinor):
+ *		runs nvmm on the SPI NOR model(spinor_sim.c) and reports the flash commands issued 
+ *		and the bus and busy time the latency model estimates per call.
+ *
+ * Usage: nvmm_bench [-b file|spinor] [-n count] [-i ids] [-l value length] [-s page_size] [-u program_unit] 
+ *					[-e erase_size] [-p program_page_size] [-c command_ns] [-d call_ns] [-r readahead] [-v] [-S] [-f file]
+ *		-S msyncs every program the same as a power loss safe setup, the key-value file is then fdatasync'ed per write.
+ *		-u is the program unit of the file backend(2, 4, 8 or 32 bytes), default to a word.
+ *		-e and -p are for the spinor backend, default to 4K bytes sectors and 256 bytes program pages.
+ *		-c is the spinor cost of a command in nanoseconds apart from the bytes, the bus and the driver overhead together.
+ *		-d is the spinor driver overhead of a method call, a vectored call pays it once for all its commands.
+ *		-v gives nvmm the vectored spinor methods(g_vector_nvmm).
+ *		-r sets a readahead window of that many bytes for the header scans(g_scan_nvmm), default to none.
+ *
+     Copyright 2017 PROJECTSUGAR
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "nvmm.h"
+#include "nvmm_file.h"
+#include "spinor_sim.h"
+
+
+#define BENCH_COUNT_DEFAULT				10000
+#define BENCH_IDS_DEFAULT				32
+#define BENCH_LENGTH_DEFAULT			16
+#define BENCH_PAGE_SIZE_DEFAULT			4096
+#define BENCH_FILE_DEFAULT				"/tmp/nvmm_bench.bin"
+#define BENCH_SPINOR_SECTOR_DEFAULT		4096
+#define BENCH_SPINOR_PAGE_DEFAULT		256
+#define BENCH_LENGTH_MAX				256
+#define BENCH_READAHEAD_MAX				4096
+
+#define BENCH_PAGE_A					1
+#define BENCH_PAGE_B					2
+
+
+static unsigned long count = BENCH_COUNT_DEFAULT ;
+static unsigned long idnum = BENCH_IDS_DEFAULT ;
+static unsigned long length = BENCH_LENGTH_DEFAULT ;
+static unsigned long page_size = BENCH_PAGE_SIZE_DEFAULT ;
+static unsigned long program_unit = 0 ;		//0 for a word.
+static int sync_writes = 0 ;
+static const char* path = BENCH_FILE_DEFAULT ;
+static const char* backend = "file" ;
+static unsigned long erase_size = BENCH_SPINOR_SECTOR_DEFAULT ;
+static unsigned long program_page_size = BENCH_SPINOR_PAGE_DEFAULT ;
+static unsigned long command_ns = 0 ;		//0 for the spinor default.
+static unsigned long call_ns = 0 ;
+static int vectored = 0 ;
+static unsigned long readahead = 0 ;
+static uint8_t window[BENCH_READAHEAD_MAX] ;
+
+
+static double now_us(void)
+{
+	struct timespec ts ;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts) ;
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3 ;
+}
+
+
+/*
+ * value of id on round, every write changes the content so nvmm can't skip it.
+ */
+static void make_value(uint8_t* value, unsigned long id, unsigned long round)
+{
+	unsigned long i ;
+
+	for(i=0;i<length;i++)
+	{
+		value[i] = (uint8_t)(id * 31 + round * 7 + i) ;
+	}
+}
+
+
+/*
+ * open the file backend and mount nvmm on it, the geometry lets the page exceed 64K bytes in 32bits address builds.
+ */
+static int open_nvmm_file(void)
+{
+	nvmm_geometry_t geometry ;
+
+	memset(&geometry, 0, sizeof(geometry)) ;
+	geometry.page_size = page_size ;
+	geometry.program_unit = program_unit ;
+
+	if(nvmm_file_open(path, BENCH_PAGE_A * page_size, 2 * page_size, page_size, geometry.program_unit, sync_writes) != 0)
+	{
+		return -1 ;
+	}
+
+	return g_init_nvmm_geometry(nvmm_file_read, nvmm_file_write, nvmm_file_erase, BENCH_PAGE_A, BENCH_PAGE_B, &geometry) ;
+}
+
+
+static int bench_nvmm(double* write_us, double* read_us)
+{
+	uint8_t value[BENCH_LENGTH_MAX] ;
+	uint8_t buf[BENCH_LENGTH_MAX] ;
+	double start ;
+	unsigned long i ;
+
+	unlink(path) ;
+	if(open_nvmm_file() != 0)
+	{
+		return -1 ;
+	}
+
+	start = now_us() ;
+	for(i=0;i<count;i++)
+	{
+		make_value(value, i % idnum, i / idnum) ;
+		if(g_write_nvmm(i % idnum, length, value) != 0)
+		{
+			return -1 ;
+		}
+	}
+	*write_us = (now_us() - start) / count ;
+
+	start = now_us() ;
+	for(i=0;i<count;i++)
+	{
+		if(g_read_nvmm(i % idnum, length, buf, sizeof(buf)) != 0)
+		{
+			return -1 ;
+		}
+	}
+	*read_us = (now_us() - start) / count ;
+
+	//the content must survive re-opening.
+	nvmm_file_close() ;
+	if(open_nvmm_file() != 0)
+	{
+		return -1 ;
+	}
+	for(i=count-idnum;i<count;i++)
+	{
+		make_value(value, i % idnum, i / idnum) ;
+		if(g_read_nvmm(i % idnum, length, buf, sizeof(buf)) != 0 || memcmp(buf, value, length) != 0)
+		{
+			fprintf(stderr, "id %lu read back wrong.\n", i % idnum) ;
+			return -1 ;
+		}
+	}
+	nvmm_file_close() ;
+
+	return 0 ;
+}
+
+
+/*
+ * write, read and verify on the mounted nvmm, reporting the flash traffic of each phase.
+ */
+static int run_spinor_phase(int writing, spinor_stats_t* stats)
+{
+	uint8_t value[BENCH_LENGTH_MAX] ;
+	uint8_t buf[BENCH_LENGTH_MAX] ;
+	unsigned long i ;
+
+	spinor_reset_stats() ;
+	for(i=0;i<count;i++)
+	{
+		make_value(value, i % idnum, i / idnum) ;
+		if(writing)
+		{
+			if(g_write_nvmm(i % idnum, length, value) != 0)
+			{
+				return -1 ;
+			}
+		}
+		else if(i >= count - idnum)
+		{//the latest round, compare the content.
+			if(g_read_nvmm(i % idnum, length, buf, sizeof(buf)) != 0 || memcmp(buf, value, length) != 0)
+			{
+				fprintf(stderr, "id %lu read back wrong.\n", i % idnum) ;
+				return -1 ;
+			}
+		}
+		else if(g_read_nvmm(i % idnum, length, buf, sizeof(buf)) != 0)
+		{
+			return -1 ;
+		}
+	}
+	spinor_get_stats(stats) ;
+
+	return 0 ;
+}
+
+
+static void print_spinor_phase(const char* name, const spinor_stats_t* stats)
+{
+	printf("%-8s %10.2f %10.2f %10.2f %10.2f %10.2f %10.3f %12.1f\n", name, (double)stats->calls / count, \
+		(double)stats->read_commands / count, \
+		(double)stats->read_bytes / count, (double)stats->program_commands / count, \
+		(double)stats->program_bytes / count, (double)stats->erase_commands / count, stats->elapsed_ns / 1e3 / count) ;
+}
+
+
+static int bench_spinor(void)
+{
+	spinor_config_t config ;
+	spinor_stats_t mount ;
+	spinor_stats_t writes ;
+	spinor_stats_t reads ;
+	nvmm_geometry_t geometry ;
+
+	spinor_default_config(&config, (BENCH_PAGE_B + 1) * page_size) ;
+	config.sector_size = erase_size ;
+	config.page_size = program_page_size ;
+	if(command_ns != 0)
+	{
+		config.command_ns = command_ns ;
+	}
+	config.call_ns = call_ns ;
+	memset(&geometry, 0, sizeof(geometry)) ;
+	geometry.page_size = page_size ;
+	geometry.erase_size = erase_size ;
+	geometry.program_page_size = program_page_size ;
+	geometry.program_unit = 0 ;		//spinor_sim takes words.
+
+	if(spinor_open(&config) != 0 || g_scan_nvmm(window, readahead) != 0 || \
+		g_vector_nvmm(vectored? spinor_readv : 0, vectored? spinor_writev : 0) != 0 || \
+		g_init_nvmm_geometry(spinor_read, spinor_write, spinor_erase, BENCH_PAGE_A, BENCH_PAGE_B, &geometry) != 0)
+	{
+		return -1 ;
+	}
+	if(run_spinor_phase(1, &writes) != 0)
+	{
+		return -1 ;
+	}
+
+	//mount again so the reads see what the chip holds, not what the last writes left.
+	spinor_reset_stats() ;
+	if(g_init_nvmm_geometry(spinor_read, spinor_write, spinor_erase, BENCH_PAGE_A, BENCH_PAGE_B, &geometry) != 0)
+	{
+		return -1 ;
+	}
+	spinor_get_stats(&mount) ;
+	if(run_spinor_phase(0, &reads) != 0)
+	{
+		return -1 ;
+	}
+	spinor_close() ;
+
+	if(writes.page_wraps || writes.misaligned)
+	{
+		fprintf(stderr, "%u programs crossed a page, %u erases misaligned.\n", writes.page_wraps, writes.misaligned) ;
+		return -1 ;
+	}
+
+	printf("%lu writes and reads over %lu ids, %lu bytes each, page size %lu, sector %lu, program page %lu, readahead %lu%s\n", \
+		count, idnum, length, page_size, erase_size, program_page_size, readahead, vectored? ", vectored" : "") ;
+	printf("mount %u read commands, %.1f us\n", mount.read_commands, mount.elapsed_ns / 1e3) ;
+	printf("%-8s %10s %10s %10s %10s %10s %10s %12s\n", "per call", "methods", "reads", "read B", "programs", \
+		"program B", "erases", "us") ;
+	print_spinor_phase("write", &writes) ;
+	print_spinor_phase("read", &reads) ;
+
+	return 0 ;
+}
+
+
+static int bench_kv(double* write_us, double* read_us)
+{
+	uint8_t value[BENCH_LENGTH_MAX] ;
+	uint8_t buf[BENCH_LENGTH_MAX] ;
+	double start ;
+	unsigned long i ;
+	int fd ;
+
+	unlink(path) ;
+	fd = open(path, O_RDWR | O_CREAT, 0644) ;
+	if(fd < 0)
+	{
+		return -1 ;
+	}
+
+	start = now_us() ;
+	for(i=0;i<count;i++)
+	{
+		make_value(value, i % idnum, i / idnum) ;
+		if(pwrite(fd, value, length, (i % idnum) * length) != (ssize_t)length || \
+			(sync_writes && fdatasync(fd) != 0))
+		{
+			close(fd) ;
+			return -1 ;
+		}
+	}
+	*write_us = (now_us() - start) / count ;
+
+	start = now_us() ;
+	for(i=0;i<count;i++)
+	{
+		if(pread(fd, buf, length, (i % idnum) * length) != (ssize_t)length)
+		{
+			close(fd) ;
+			return -1 ;
+		}
+	}
+	*read_us = (now_us() - start) / count ;
+
+	close(fd) ;
+
+	return 0 ;
+}
+
+
+int main(int argc, char** argv)
+{
+	double nvmm_write, nvmm_read ;
+	double kv_write, kv_read ;
+	int opt ;
+
+	while((opt = getopt(argc, argv, "b:n:i:l:s:u:e:p:c:d:r:vSf:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'b':
+			backend = optarg ;
+			break ;
+		case 'e':
+			erase_size = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'p':
+			program_page_size = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'c':
+			command_ns = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'd':
+			call_ns = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'v':
+			vectored = 1 ;
+			break ;
+		case 'r':
+			readahead = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'n':
+			count = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'i':
+			idnum = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'l':
+			length = strtoul(optarg, 0, 0) ;
+			break ;
+		case 's':
+			page_size = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'u':
+			program_unit = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'S':
+			sync_writes = 1 ;
+			break ;
+		case 'f':
+			path = optarg ;
+			break ;
+		default:
+			fprintf(stderr, "usage: nvmm_bench [-b file|spinor] [-n count] [-i ids] [-l value length] [-s page_size] [-u program_unit] "
+				"[-e erase_size] [-p program_page_size] [-c command_ns] [-d call_ns] [-r readahead] [-v] [-S] [-f file]\n") ;
+			return 1 ;
+		}
+	}
+	if(idnum == 0 || idnum > 0x7FFF || count < idnum || length == 0 || length > BENCH_LENGTH_MAX || \
+		page_size == 0 || page_size == 0xFFFF || readahead > BENCH_READAHEAD_MAX)
+	{
+		fprintf(stderr, "bad parameters.\n") ;
+		return 1 ;
+	}
+
+	if(strcmp(backend, "spinor") == 0)
+	{
+		if(bench_spinor() != 0)
+		{
+			fprintf(stderr, "nvmm on spinor failed.\n") ;
+			return 1 ;
+		}
+		return 0 ;
+	}
+
+	if(bench_nvmm(&nvmm_write, &nvmm_read) != 0)
+	{
+		fprintf(stderr, "nvmm file backend failed.\n") ;
+		return 1 ;
+	}
+	if(bench_kv(&kv_write, &kv_read) != 0)
+	{
+		fprintf(stderr, "key-value file failed.\n") ;
+		return 1 ;
+	}
+	unlink(path) ;
+
+	printf("%lu writes and reads over %lu ids, %lu bytes each, page size %lu, %s\n", count, idnum, length, \
+		page_size, sync_writes? "synced" : "not synced") ;
+	printf("%-22s %12s %12s\n", "", "write us", "read us") ;
+	printf("%-22s %12.2f %12.2f\n", "nvmm file backend", nvmm_write, nvmm_read) ;
+	printf("%-22s %12.2f %12.2f\n", "key-value file", kv_write, kv_read) ;
+
+	return 0 ;
+}
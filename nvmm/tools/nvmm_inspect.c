@@ -0,0 +1,344 @@
+/*
+ * File Name: nvmm_inspect.c
+ * Author: PROJECTSUGAR
+ * Description:
+ * Offline NVMM image inspector and compactor.
+ * Decodes a flash dump of the two NVMM pages, lists the live and superseded lines of every id
+ * and reports the free space, the fragmentation, the erase counts and how many reads lookups take.
+ * Optionally writes out a compacted image.
+ * The dump is mounted with nvmm.c itself on a RAM flash, so it's decoded by exactly the rules the firmware uses,
+ * an interrupted defrag in the dump is completed the same way g_init_nvmm completes it on target.
+ *
+ * Usage: nvmm_inspect [-a page_a] [-b page_b] [-A cold_page_a -B cold_page_b] [-s page_size] [-u program_unit] [-C] 
+ *					[-c compacted.bin] dump.bin
+ *		The dump starts at the lowest of the pages, the same as nvmm_mkimage output.
+ *		-A and -B mount the cold page group(g_init_nvmm_cold) too, the dump then holds all four pages.
+ *		The line header format is told by the dump, the compacted image has standard headers unless -C.
+ *
+     Copyright 2017 PROJECTSUGAR
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "nvmm.h"
+#include "ramflash.h"
+
+
+#define INSPECT_PAGE_A_DEFAULT			1
+#define INSPECT_PAGE_B_DEFAULT			2
+#define INSPECT_PAGE_SIZE_DEFAULT		2048
+#define INSPECT_PROGRAM_UNIT_DEFAULT	4
+#define INSPECT_ID_NUM					0x10000
+#define INSPECT_PAGE_NONE				0xFFFF		//no cold page group.
+
+
+/*
+ * per id statistics.
+ */
+typedef struct{
+	uint32_t live ;
+	uint32_t superseded ;
+	uint32_t live_bytes ;
+	uint32_t stale_bytes ;
+	uint32_t depth ;		//line headers and index entries read before the live line is found.
+	uint8_t cold ;			//the live line is in the cold group.
+}inspect_id_t ;
+
+static inspect_id_t ids[INSPECT_ID_NUM] ;
+static uint32_t hot_miss = 0 ;			//reads to miss the hot group, a cold item is looked up there first.
+static uint8_t walking_cold = 0 ;
+static uint32_t cold_live = 0 ;			//bytes of the cold group, g_nvmm_info reports the hot group only.
+static uint32_t cold_stale = 0 ;
+static unsigned long cold_a = INSPECT_PAGE_NONE ;
+static unsigned long cold_b = INSPECT_PAGE_NONE ;
+static unsigned long page_size = INSPECT_PAGE_SIZE_DEFAULT ;
+
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: nvmm_inspect [-a page_a] [-b page_b] [-A cold_page_a -B cold_page_b] [-s page_size] [-u program_unit] [-C] "
+		"[-c compacted.bin] dump.bin\n") ;
+}
+
+
+static const char* page_state(uint32_t state)
+{
+	switch(state)
+	{
+	case 0xAAAAAAAA:
+		return "active" ;
+	case 0x00000000:
+		return "dummy, defrag was interrupted" ;
+	case 0xFFFFFFFF:
+		return "erased" ;
+	default:
+		return "undefined, will be formatted" ;
+	}
+}
+
+
+/*
+ * a lookup walks the line headers down to the latest index line, then binary searches the index for the lines below it,
+ * g_walk_nvmm reports the reads it takes for every line.
+ * the items are taken as NVMM_CLASS_AUTO, looked up in the hot group first,
+ * so a cold line of an id still live in the hot group is stale.
+ */
+static int count_line(const nvmm_lineinfo_t* line, void* arg)
+{
+	inspect_id_t* item = &ids[line->id] ;
+	unsigned long page = line->address / page_size ;
+
+	(void)arg ;
+
+	if(page == cold_a || page == cold_b)
+	{
+		walking_cold = 1 ;
+	}
+	else
+	{//missing the hot group reads down to its last line, or searches its index.
+		hot_miss = line->indexed? line->reads : line->reads + 1 ;
+	}
+
+	if(line->live && item->live == 0)
+	{
+		item->live++ ;
+		item->live_bytes += line->len ;
+		cold_live += walking_cold? line->len : 0 ;
+		item->depth = (walking_cold? hot_miss : 0) + line->reads ;
+		item->cold = walking_cold ;
+	}
+	else
+	{
+		item->superseded++ ;
+		item->stale_bytes += line->len ;
+		cold_stale += walking_cold? line->len : 0 ;
+	}
+
+	return 0 ;
+}
+
+
+static void report(void)
+{
+	nvmm_info_t info ;
+	nvmm_wear_t wear ;
+	uint32_t live = 0, superseded = 0 ;
+	uint32_t live_bytes = 0, stale_bytes = 0 ;
+	uint32_t depth = 0, max_depth = 0 ;
+	uint32_t id ;
+
+	g_nvmm_info(&info) ;
+
+	printf("active page %u, page size %u, used %u, free %u\n", info.active_page, info.page_size, \
+		info.used, info.free) ;
+	if(g_nvmm_wear(0, 0, &wear) == 0)
+	{
+		printf("erases page A %u, page B %u\n", wear.erases_a, wear.erases_b) ;
+	}
+	if(cold_a != INSPECT_PAGE_NONE && g_nvmm_wear(1, 0, &wear) == 0)
+	{
+		printf("erases cold page A %u, cold page B %u\n", wear.erases_a, wear.erases_b) ;
+	}
+	printf("\n") ;
+	printf("%6s %5s %10s %12s %10s %12s\n", "id", "group", "live bytes", "superseded", "stale", "lookup reads") ;
+	for(id=0;id<INSPECT_ID_NUM;id++)
+	{
+		if(ids[id].live == 0)
+		{
+			continue ;
+		}
+		printf("%6u %5s %10u %12u %10u %12u\n", id, ids[id].cold? "cold" : "hot", ids[id].live_bytes, \
+			ids[id].superseded, ids[id].stale_bytes, ids[id].depth) ;
+
+		live++ ;
+		superseded += ids[id].superseded ;
+		live_bytes += ids[id].live_bytes ;
+		stale_bytes += ids[id].stale_bytes ;
+		depth += ids[id].depth ;
+		if(ids[id].depth > max_depth)
+		{
+			max_depth = ids[id].depth ;
+		}
+	}
+
+	printf("\n%u live ids, %u superseded lines\n", live, superseded) ;
+	if(cold_a != INSPECT_PAGE_NONE)
+	{//the page usage below is of the hot group.
+		printf("cold group live data %u bytes, stale data %u bytes\n", cold_live, cold_stale) ;
+		live_bytes -= cold_live ;
+		stale_bytes -= cold_stale ;
+	}
+	printf("live data %u bytes, stale data %u bytes, headers, padding and unreadable %u bytes\n", live_bytes, stale_bytes, \
+		info.used - live_bytes - stale_bytes) ;
+	printf("fragmentation %.1f%% of the used space is stale\n", \
+		info.used? 100.0 * stale_bytes / info.used : 0.0) ;
+	if(live)
+	{
+		printf("lookup reads average %.1f, worst %u\n", (double)depth / live, max_depth) ;
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	unsigned long page_a = INSPECT_PAGE_A_DEFAULT ;
+	unsigned long page_b = INSPECT_PAGE_B_DEFAULT ;
+	unsigned long header_format = NVMM_HEADER_STANDARD ;
+	unsigned long program_unit = INSPECT_PROGRAM_UNIT_DEFAULT ;
+	unsigned long first, last ;
+	const char* compacted = 0 ;
+	uint32_t state ;
+	size_t size ;
+	FILE* fp ;
+	nvmm_geometry_t geometry ;
+	int opt ;
+	int rc ;
+
+	while((opt = getopt(argc, argv, "a:b:A:B:s:u:Cc:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'a':
+			page_a = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'b':
+			page_b = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'A':
+			cold_a = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'B':
+			cold_b = strtoul(optarg, 0, 0) ;
+			break ;
+		case 's':
+			page_size = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'u':
+			program_unit = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'C':
+			header_format = NVMM_HEADER_COMPACT ;
+			break ;
+		case 'c':
+			compacted = optarg ;
+			break ;
+		default:
+			usage() ;
+			return 1 ;
+		}
+	}
+	if(optind + 1 != argc || page_a == page_b || page_a >= 0xFFFF || page_b >= 0xFFFF || \
+		page_size == 0 || page_size == 0xFFFF || (cold_a == INSPECT_PAGE_NONE) != (cold_b == INSPECT_PAGE_NONE) || \
+		(cold_a != INSPECT_PAGE_NONE && (cold_a > INSPECT_PAGE_NONE || cold_b > INSPECT_PAGE_NONE || cold_a == cold_b || \
+		cold_a == page_a || cold_a == page_b || cold_b == page_a || cold_b == page_b)))
+	{
+		usage() ;
+		return 1 ;
+	}
+
+	memset(&geometry, 0, sizeof(geometry)) ;
+	geometry.page_size = page_size ;
+	geometry.program_unit = program_unit ;
+	geometry.header_format = header_format ;
+
+	first = (page_a < page_b)? page_a : page_b ;
+	last = (page_a < page_b)? page_b : page_a ;
+	if(cold_a != INSPECT_PAGE_NONE)
+	{
+		first = (cold_a < first)? cold_a : first ;
+		first = (cold_b < first)? cold_b : first ;
+		last = (cold_a > last)? cold_a : last ;
+		last = (cold_b > last)? cold_b : last ;
+	}
+	size = (last - first + 1) * page_size ;
+
+	if(ramflash_open(last + 1, page_size, program_unit) != 0)
+	{
+		fprintf(stderr, "no memory for the flash model.\n") ;
+		return 1 ;
+	}
+
+	fp = fopen(argv[optind], "rb") ;
+	if(fp == 0)
+	{
+		perror(argv[optind]) ;
+		return 1 ;
+	}
+	rc = fread(ramflash_data() + first * page_size, 1, size, fp) != size ;
+	fclose(fp) ;
+	if(rc != 0)
+	{
+		fprintf(stderr, "%s: expecting %lu bytes of dump.\n", argv[optind], (unsigned long)size) ;
+		return 1 ;
+	}
+
+	memcpy(&state, ramflash_data() + page_a * page_size, sizeof(state)) ;
+	printf("page A (page %lu): 0x%08x %s\n", page_a, state, page_state(state)) ;
+	memcpy(&state, ramflash_data() + page_b * page_size, sizeof(state)) ;
+	printf("page B (page %lu): 0x%08x %s\n", page_b, state, page_state(state)) ;
+	if(cold_a != INSPECT_PAGE_NONE)
+	{
+		memcpy(&state, ramflash_data() + cold_a * page_size, sizeof(state)) ;
+		printf("cold page A (page %lu): 0x%08x %s\n", cold_a, state, page_state(state)) ;
+		memcpy(&state, ramflash_data() + cold_b * page_size, sizeof(state)) ;
+		printf("cold page B (page %lu): 0x%08x %s\n", cold_b, state, page_state(state)) ;
+	}
+
+	if(g_init_nvmm_geometry(ramflash_read, ramflash_write, ramflash_erase, page_a, page_b, &geometry) != 0)
+	{
+		fprintf(stderr, "mounting the dump failed.\n") ;
+		return 1 ;
+	}
+	if(cold_a != INSPECT_PAGE_NONE && g_init_nvmm_cold(cold_a, cold_b, 0) != 0)
+	{
+		fprintf(stderr, "mounting the cold pages of the dump failed.\n") ;
+		return 1 ;
+	}
+	if(g_walk_nvmm(count_line, 0) != 0)
+	{
+		fprintf(stderr, "the active page is broken, report is incomplete.\n") ;
+	}
+	report() ;
+
+	if(compacted != 0)
+	{
+		if(g_defrag_nvmm() != 0)
+		{
+			fprintf(stderr, "compacting failed.\n") ;
+			return 1 ;
+		}
+
+		fp = fopen(compacted, "wb") ;
+		if(fp == 0)
+		{
+			perror(compacted) ;
+			return 1 ;
+		}
+		rc = fwrite(ramflash_data() + first * page_size, 1, size, fp) != size ;
+		fclose(fp) ;
+		if(rc != 0)
+		{
+			fprintf(stderr, "writing %s failed.\n", compacted) ;
+			return 1 ;
+		}
+		printf("\ncompacted image written to %s.\n", compacted) ;
+	}
+
+	ramflash_close() ;
+
+	return 0 ;
+}
@@ -0,0 +1,336 @@
+/*
+ * File Name: nvmm_mkimage.c
+ * Author: PROJECTSUGAR
+ * Description:
+ * Offline NVMM image builder.
+ * Reads an id->value manifest and emits a binary holding both NVMM pages,
+ * ready to be programmed together with the firmware image.
+ * The image is produced by running nvmm.c itself on a RAM flash,
+ * so the page and line headers are exactly what g_write_nvmm would leave on target.
+ * Note. The image is built in host byte order, the host and the target must share the same endianness.
+ *
+ * Usage: nvmm_mkimage [-a page_a] [-b page_b] [-s page_size] [-u program_unit] [-C] [-z level] -o image.bin manifest.txt
+ *		-C builds the pages with compact line headers.
+ *		-z compresses the items at level 1 to 8, the firmware reads them whether it compresses or not.
+ *
+ * Manifest, one item per line, '#' starts a comment, ids are below 0x8000, or below 0xFFF with -C:
+ *		<id> str <text>			text up to the end of line, stored without the terminating zero.
+ *		<id> hex <hex bytes>	for example "0 hex 01 02 0a ff" or "0 hex 01020aff".
+ *		<id> u8|u16|u32 <num>	decimal or 0x prefixed number, stored in little endian.
+ *		<id> file <path>		raw content of a file.
+ *
+     Copyright 2017 PROJECTSUGAR
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include "nvmm.h"
+#include "ramflash.h"
+
+
+#define MKIMAGE_PAGE_A_DEFAULT			1
+#define MKIMAGE_PAGE_B_DEFAULT			2
+#define MKIMAGE_PAGE_SIZE_DEFAULT		2048
+#define MKIMAGE_PROGRAM_UNIT_DEFAULT	4
+#define MKIMAGE_LINE_MAXLENGTH			1024
+#define MKIMAGE_VALUE_MAXLENGTH			0x8000
+#define MKIMAGE_ID_LIMIT				0x8000		//ids are below it, the same as g_write_nvmm takes.
+#define MKIMAGE_COMPACT_ID_LIMIT		0x0FFF		//below it on a page of compact line headers.
+
+
+static uint8_t value[MKIMAGE_VALUE_MAXLENGTH] ;
+static uint8_t level = NVMM_COMPRESS_NONE ;
+static unsigned long id_limit = MKIMAGE_ID_LIMIT ;
+
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: nvmm_mkimage [-a page_a] [-b page_b] [-s page_size] [-u program_unit] [-C] [-z level] -o image.bin manifest.txt\n") ;
+}
+
+
+static uint8_t compress_level(uint16_t id, size_t len)
+{
+	(void)id ;
+	(void)len ;
+
+	return level ;
+}
+
+
+static int hex_nibble(char c)
+{
+	if(c >= '0' && c <= '9')
+	{
+		return c - '0' ;
+	}
+	c = tolower(c) ;
+	if(c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10 ;
+	}
+	return -1 ;
+}
+
+
+/*
+ * parse the value part of a manifest line.
+ * will return the value length, -1 for something error.
+ */
+static long parse_value(const char* type, char* text)
+{
+	unsigned long num ;
+	char* end ;
+	long len = 0 ;
+	int hi, lo ;
+	FILE* fp ;
+
+	if(strcmp(type, "str") == 0)
+	{
+		len = strlen(text) ;
+		memcpy(value, text, len) ;
+	}
+	else if(strcmp(type, "hex") == 0)
+	{
+		while(*text)
+		{
+			if(isspace((unsigned char)*text))
+			{
+				text++ ;
+				continue ;
+			}
+			hi = hex_nibble(text[0]) ;
+			lo = hex_nibble(text[1]) ;
+			if(hi < 0 || lo < 0 || len >= MKIMAGE_VALUE_MAXLENGTH)
+			{
+				return -1 ;
+			}
+			value[len++] = (uint8_t)(hi << 4 | lo) ;
+			text += 2 ;
+		}
+	}
+	else if(strcmp(type, "u8") == 0 || strcmp(type, "u16") == 0 || strcmp(type, "u32") == 0)
+	{
+		num = strtoul(text, &end, 0) ;
+		if(end == text)
+		{
+			return -1 ;
+		}
+		len = (type[1] == '8')? 1 : (type[1] == '1')? 2 : 4 ;
+		if(len < 4 && num >> (len * 8))
+		{
+			return -1 ;
+		}
+		value[0] = (uint8_t)num ;
+		value[1] = (uint8_t)(num >> 8) ;
+		value[2] = (uint8_t)(num >> 16) ;
+		value[3] = (uint8_t)(num >> 24) ;
+	}
+	else if(strcmp(type, "file") == 0)
+	{
+		fp = fopen(text, "rb") ;
+		if(fp == 0)
+		{
+			return -1 ;
+		}
+		len = fread(value, 1, MKIMAGE_VALUE_MAXLENGTH, fp) ;
+		if(!feof(fp))
+		{
+			len = -1 ;
+		}
+		fclose(fp) ;
+	}
+	else
+	{
+		return -1 ;
+	}
+
+	return len ;
+}
+
+
+static int build(FILE* manifest)
+{
+	char line[MKIMAGE_LINE_MAXLENGTH] ;
+	char* p ;
+	char* type ;
+	char* text ;
+	unsigned long id ;
+	long len ;
+	int lineno = 0 ;
+
+	while(fgets(line, sizeof(line), manifest) != 0)
+	{
+		lineno++ ;
+		line[strcspn(line, "\r\n")] = 0 ;
+
+		p = line ;
+		while(isspace((unsigned char)*p))
+		{
+			p++ ;
+		}
+		if(*p == 0 || *p == '#')
+		{
+			continue ;
+		}
+
+		id = strtoul(p, &p, 0) ;
+		type = strtok(p, " \t") ;
+		text = strtok(0, "") ;
+		if(type == 0 || text == 0)
+		{
+			fprintf(stderr, "line %d: missing type or value.\n", lineno) ;
+			return -1 ;
+		}
+		while(isspace((unsigned char)*text))
+		{
+			text++ ;
+		}
+
+		if(id >= id_limit)
+		{
+			fprintf(stderr, "line %d: id %lu is out of range, ids are below 0x%lX with %s line headers.\n", lineno, id, \
+				id_limit, (id_limit == MKIMAGE_COMPACT_ID_LIMIT)? "compact" : "standard") ;
+			return -1 ;
+		}
+		len = parse_value(type, text) ;
+		if(len <= 0)
+		{
+			fprintf(stderr, "line %d: bad value.\n", lineno) ;
+			return -1 ;
+		}
+
+		if(g_write_nvmm((uint16_t)id, len, value) != 0)
+		{
+			fprintf(stderr, "line %d: writing id %lu failed.\n", lineno, id) ;
+			return -1 ;
+		}
+	}
+
+	return 0 ;
+}
+
+
+int main(int argc, char** argv)
+{
+	unsigned long page_a = MKIMAGE_PAGE_A_DEFAULT ;
+	unsigned long page_b = MKIMAGE_PAGE_B_DEFAULT ;
+	unsigned long page_size = MKIMAGE_PAGE_SIZE_DEFAULT ;
+	unsigned long header_format = NVMM_HEADER_STANDARD ;
+	unsigned long program_unit = MKIMAGE_PROGRAM_UNIT_DEFAULT ;
+	unsigned long first, last ;
+	const char* output = 0 ;
+	FILE* manifest ;
+	FILE* image ;
+	nvmm_geometry_t geometry ;
+	int opt ;
+	int rc ;
+
+	while((opt = getopt(argc, argv, "a:b:s:u:Cz:o:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'a':
+			page_a = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'b':
+			page_b = strtoul(optarg, 0, 0) ;
+			break ;
+		case 's':
+			page_size = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'u':
+			program_unit = strtoul(optarg, 0, 0) ;
+			break ;
+		case 'C':
+			header_format = NVMM_HEADER_COMPACT ;
+			id_limit = MKIMAGE_COMPACT_ID_LIMIT ;
+			break ;
+		case 'z':
+			level = (uint8_t)strtoul(optarg, 0, 0) ;
+			break ;
+		case 'o':
+			output = optarg ;
+			break ;
+		default:
+			usage() ;
+			return 1 ;
+		}
+	}
+	if(output == 0 || optind + 1 != argc || level > NVMM_COMPRESS_BEST || page_a == page_b || page_a >= 0xFFFF || page_b >= 0xFFFF || \
+		page_size == 0 || page_size == 0xFFFF)
+	{
+		usage() ;
+		return 1 ;
+	}
+
+	memset(&geometry, 0, sizeof(geometry)) ;
+	geometry.page_size = page_size ;
+	geometry.program_unit = program_unit ;
+	geometry.header_format = header_format ;
+
+	first = (page_a < page_b)? page_a : page_b ;
+	last = (page_a < page_b)? page_b : page_a ;
+
+	if(ramflash_open(last + 1, page_size, program_unit) != 0)
+	{
+		fprintf(stderr, "no memory for the flash model.\n") ;
+		return 1 ;
+	}
+	if(g_init_nvmm_geometry(ramflash_read, ramflash_write, ramflash_erase, page_a, page_b, &geometry) != 0)
+	{
+		fprintf(stderr, "initializing nvmm failed.\n") ;
+		return 1 ;
+	}
+	g_compress_nvmm(compress_level) ;
+
+	manifest = fopen(argv[optind], "r") ;
+	if(manifest == 0)
+	{
+		perror(argv[optind]) ;
+		return 1 ;
+	}
+	rc = build(manifest) ;
+	fclose(manifest) ;
+	if(rc != 0)
+	{
+		return 1 ;
+	}
+
+	image = fopen(output, "wb") ;
+	if(image == 0)
+	{
+		perror(output) ;
+		return 1 ;
+	}
+	//pages between A and B, if any, are left blank(0xFF).
+	rc = fwrite(ramflash_data() + first * page_size, page_size, last - first + 1, image) != last - first + 1 ;
+	fclose(image) ;
+	if(rc != 0)
+	{
+		fprintf(stderr, "writing %s failed.\n", output) ;
+		return 1 ;
+	}
+
+	printf("%s: %lu bytes, program at flash offset 0x%08lx.\n", output, (last - first + 1) * page_size, \
+		first * page_size) ;
+
+	ramflash_close() ;
+
+	return 0 ;
+}
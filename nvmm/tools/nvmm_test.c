@@ -0,0 +1,1306 @@
+/*
+ * File Name: nvmm_test.c
+ * Author: PROJECTSUGAR
+ * Description:
+ * NVMM host regression test.
+ * Runs nvmm.c on a RAM flash(ramflash.c) in every program unit and line header format it supports,
+ * and checks what is read back, after a remount too:
+ * 		items of every length class across defrags, compressed and deduplicated items,
+ * 		and power cuts replayed at every program and erase of a write and of a defrag,
+ * 		streams, read back after they're closed and dropped if they're closed short,
+ * 		plain and compressed items read at an offset and through cursors,
+ * 		items moved to the cold group and read back from both groups,
+ * 		items found through the index line a defrag writes and through index checkpoints,
+ * 		ids never written, turned away by a bloom filter, items read from a RAM shadow of the page,
+ * 		mounts taking the retained mount state, or the flash if it's out of date,
+ * 		and header scans through a readahead window.
+ * A second pass sets the value cache before mounting, runs the rewrites and the power cuts again,
+ * and checks the cache is dropped on a write, a stream, a remount and mounting the cold group.
+ * A third pass does the same through vectored methods, the power cuts fall in the middle of their calls too.
+ * The items are also written and read back through the Linux file backend(port/nvmm_file.c), reopened in between.
+ * Build it for both address widths, "make test" does both and runs them.
+ *
+ * Usage: nvmm_test
+ *		prints a line per failed check, and exits with 1 if any failed.
+ *
+     Copyright 2017 PROJECTSUGAR
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include "nvmm.h"
+#include "ramflash.h"
+#include "nvmm_file.h"
+
+
+#define TEST_PAGE_A						1
+#define TEST_PAGE_B						2
+#define TEST_PAGE_COLD_A				3
+#define TEST_PAGE_COLD_B				4
+#define TEST_PAGE_NUM					5
+#define TEST_PAGE_SIZE					4096
+#define TEST_VALUE_MAXLENGTH			1024
+#define TEST_ID_NUM						24
+#define TEST_ROUNDS						12		//enough rewrites of every id for several defrags.
+
+#define TEST_ID_COMPRESSED				0x10
+#define TEST_ID_ORIGINAL				0x20
+#define TEST_ID_COPY					0x21
+#define TEST_ID_CUT						0x30
+#define TEST_CUT_LENGTH					100
+#define TEST_CUT_CACHED_LENGTH			13		//short enough for the cache.
+#define TEST_ID_CACHED					0x40
+#define TEST_ID_STREAM					0x50
+#define TEST_STREAM_LENGTH				1000
+#define TEST_ID_CURSOR					0x60
+#define TEST_CURSOR_CHUNK				90
+#define TEST_ID_AUTO_NUM				8		//ids 0 on are auto, these two follow.
+#define TEST_ID_HOT						8
+#define TEST_ID_COLD					9
+#define TEST_CHECKPOINT					5		//lines between the index checkpoints.
+#define TEST_ID_UNWRITTEN				0x100	//ids from here on are never written but one.
+#define TEST_PROBES						100
+#define TEST_SCAN_SIZE					128
+#define TEST_CACHE_NUM					4		//fewer than the ids, so entries are taken over.
+
+
+static const uint32_t units[] = {2, 4, 8, 32} ;
+static const size_t lengths[] = {1, 2, 3, 4, 5, 8, 13, 24, 25, 33, 64, 100, 250} ;
+
+#define LENGTH(id)						lengths[(id) % (sizeof(lengths) / sizeof(lengths[0]))]
+
+static nvmm_geometry_t geometry ;
+static int failures = 0 ;
+static long budget = -1 ;		//programs and erases left before the power is cut, -1 for no cut.
+static uint32_t flash_reads = 0 ;
+static jmp_buf power_cut ;
+static char path[] = "/tmp/nvmm_test_XXXXXX" ;
+static uint8_t snapshot[TEST_PAGE_NUM * TEST_PAGE_SIZE] ;
+static nvmm_cache_t cache[TEST_CACHE_NUM] ;
+static int cached = 0 ;		//the value cache is set before the first mount, and kept over the remounts.
+static int vectored = 0 ;		//the same for the vectored methods.
+static uint32_t vector_calls = 0 ;
+static uint32_t vector_segments = 0 ;
+
+
+#define CHECK(cond, what)				check((cond) != 0, what, __LINE__)
+
+static void check(int ok, const char* what, int line)
+{
+	if(!ok)
+	{
+		fprintf(stderr, "line %d, unit %u, %s headers, %d bits: %s failed.\n", line, (unsigned)geometry.program_unit, \
+			(geometry.header_format == NVMM_HEADER_COMPACT)? "compact" : "standard", NVMM_ADDRESS_WIDTH, what) ;
+		failures++ ;
+	}
+}
+
+
+static int count_read(uint32_t address, uint8_t* buf, size_t bufsize, size_t datlen)
+{
+	flash_reads++ ;
+
+	return ramflash_read(address, buf, bufsize, datlen) ;
+}
+
+
+/*
+ * flash methods losing the power after budget programs and erases.
+ * every program unit is a program of its own, the same as a flash word programmed or not after a power loss.
+ */
+static int cut_write(uint32_t address, uint8_t* dat, size_t wordnum)
+{
+	size_t i ;
+
+	for(i=0;i<wordnum;i++)
+	{
+		if(budget == 0)
+		{
+			longjmp(power_cut, 1) ;
+		}
+		if(budget > 0)
+		{
+			budget-- ;
+		}
+		if(ramflash_write(address + i * geometry.program_unit, dat + i * geometry.program_unit, 1) != 0)
+		{
+			return -1 ;
+		}
+	}
+
+	return 0 ;
+}
+
+
+static int cut_erase(uint32_t address)
+{
+	if(budget == 0)
+	{
+		longjmp(power_cut, 1) ;
+	}
+	if(budget > 0)
+	{
+		budget-- ;
+	}
+
+	return ramflash_erase(address) ;
+}
+
+
+/*
+ * vectored methods over the ones above, a segment must be whole program units.
+ */
+static int cut_writev(const nvmm_segment_t* segments, size_t num)
+{
+	size_t i ;
+
+	vector_calls++ ;
+	for(i=0;i<num;i++)
+	{
+		vector_segments++ ;
+		if(segments[i].address % geometry.program_unit != 0 || segments[i].len % geometry.program_unit != 0 || \
+			cut_write(segments[i].address, segments[i].buf, segments[i].len / geometry.program_unit) != 0)
+		{
+			return -1 ;
+		}
+	}
+
+	return 0 ;
+}
+
+
+static int count_readv(const nvmm_segment_t* segments, size_t num)
+{
+	size_t i ;
+
+	for(i=0;i<num;i++)
+	{
+		if(count_read(segments[i].address, segments[i].buf, segments[i].len, segments[i].len) != 0)
+		{
+			return -1 ;
+		}
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * mount nvmm on the RAM flash as it is.
+ */
+static int mount(void)
+{
+	budget = -1 ;
+
+	return g_init_nvmm_geometry(count_read, cut_write, cut_erase, TEST_PAGE_A, TEST_PAGE_B, &geometry) ;
+}
+
+
+/*
+ * erase the RAM flash and mount nvmm on it.
+ */
+static int blank(void)
+{
+	g_cache_nvmm(cached? cache : 0, cached? TEST_CACHE_NUM : 0) ;
+	g_vector_nvmm(vectored? count_readv : 0, vectored? cut_writev : 0) ;
+	vector_calls = 0 ;
+	vector_segments = 0 ;
+	if(ramflash_open(TEST_PAGE_NUM, TEST_PAGE_SIZE, geometry.program_unit) != 0)
+	{
+		return -1 ;
+	}
+
+	return mount() ;
+}
+
+
+/*
+ * the value of id in a round, a different one in every round.
+ */
+static void fill(uint8_t* dat, size_t len, uint16_t id, uint32_t round)
+{
+	uint32_t seed = (id + 1) * 2654435761u + round * 40503u ;
+	size_t i ;
+
+	for(i=0;i<len;i++)
+	{
+		seed = seed * 1103515245u + 12345u ;
+		dat[i] = (uint8_t)(seed >> 16) ;
+	}
+}
+
+
+/*
+ * check the whole item of id reads back as dat.
+ */
+static int is_item(uint16_t id, const uint8_t* dat, size_t len)
+{
+	static uint8_t buf[TEST_VALUE_MAXLENGTH] ;
+	size_t got = 0 ;
+
+	memset(buf, 0xA5, sizeof(buf)) ;
+
+	return g_read_nvmm_len(id, buf, sizeof(buf), &got) == 0 && got == len && memcmp(buf, dat, len) == 0 ;
+}
+
+
+/*
+ * check the value of id is in the cache.
+ */
+static int is_cached(uint16_t id)
+{
+	size_t i ;
+
+	for(i=0;i<TEST_CACHE_NUM;i++)
+	{
+		if(cache[i].used != 0 && cache[i].id == id)
+		{
+			return 1 ;
+		}
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * write the item of id through a stream, in pieces of 7 bytes.
+ */
+static int stream_item(uint16_t id, const uint8_t* dat, size_t len)
+{
+	size_t i ;
+	size_t piece ;
+
+	if(g_open_nvmm(id, len) != 0)
+	{
+		return -1 ;
+	}
+	for(i=0;i<len;i+=piece)
+	{
+		piece = (len - i < 7)? len - i : 7 ;
+		if(g_append_nvmm(dat + i, piece) != 0)
+		{
+			g_close_nvmm() ;
+			return -1 ;
+		}
+	}
+
+	return g_close_nvmm() ;
+}
+
+
+static uint8_t compress_all(uint16_t id, size_t len)
+{
+	(void)id ;
+	(void)len ;
+
+	return NVMM_COMPRESS_BEST ;
+}
+
+
+/*
+ * get the live line of found->id, found->live is left 0 if there is none.
+ */
+static int find_line(const nvmm_lineinfo_t* line, void* arg)
+{
+	nvmm_lineinfo_t* found = (nvmm_lineinfo_t* )arg ;
+
+	if(line->live && line->id == found->id)
+	{
+		*found = *line ;
+		return 1 ;
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * items of every length class, inline, padded and unaligned, are rewritten over several defrags,
+ * some of them through a stream, and read back after every write, after a defrag and after a remount.
+ */
+static void test_roundtrip(void)
+{
+	uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	uint32_t round ;
+	uint16_t id ;
+	nvmm_wear_t wear ;
+	nvmm_cache_stat_t stat ;
+	int ok = 1 ;
+
+	for(round=0;round<TEST_ROUNDS && ok;round++)
+	{
+		for(id=0;id<TEST_ID_NUM;id++)
+		{
+			fill(dat, LENGTH(id), id, round) ;
+			if(round % 3 == 2 && id % 4 == 0)
+			{
+				ok = ok && (stream_item(id, dat, LENGTH(id)) == 0) ;
+			}
+			else
+			{
+				ok = ok && (g_write_nvmm(id, LENGTH(id), dat) == 0) ;
+			}
+			ok = ok && is_item(id, dat, LENGTH(id)) && is_item(id, dat, LENGTH(id)) ;	//the second read hits the cache.
+		}
+	}
+	CHECK(ok, "rewriting the items and reading them back") ;
+	CHECK(g_nvmm_wear(0, 0, &wear) == 0 && wear.defrags > 0, "defragging on the way") ;
+
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, TEST_ROUNDS - 1) ;
+		ok = ok && is_item(id, dat, LENGTH(id)) ;
+	}
+	CHECK(ok, "reading the items back") ;
+
+	CHECK(g_defrag_nvmm() == 0, "defragging") ;
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, TEST_ROUNDS - 1) ;
+		ok = ok && is_item(id, dat, LENGTH(id)) ;
+	}
+	CHECK(ok, "reading the items back after a defrag") ;
+	if(cached)
+	{
+		CHECK(g_nvmm_cache(&stat) == 0 && stat.hits > 0, "reading from the cache") ;
+	}
+	if(vectored)
+	{
+		CHECK(vector_calls > 0 && vector_segments > vector_calls, "programming several segments in a call") ;
+	}
+
+	CHECK(mount() == 0, "remounting") ;
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, TEST_ROUNDS - 1) ;
+		ok = ok && is_item(id, dat, LENGTH(id)) ;
+	}
+	CHECK(ok, "reading the items back after a remount") ;
+}
+
+
+/*
+ * a highly redundant value is stored compressed, however short it gets, and reads back the same.
+ */
+static void test_compress(void)
+{
+	static uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	static uint8_t buf[TEST_VALUE_MAXLENGTH] ;
+	nvmm_lineinfo_t line ;
+	size_t len = 0 ;
+
+	memset(dat, 0, sizeof(dat)) ;
+	g_compress_nvmm(compress_all) ;
+	CHECK(g_write_nvmm(TEST_ID_COMPRESSED, sizeof(dat), dat) == 0, "writing a zero table") ;
+	g_compress_nvmm(0) ;
+
+	memset(&line, 0, sizeof(line)) ;
+	line.id = TEST_ID_COMPRESSED ;
+	CHECK(g_walk_nvmm(find_line, &line) == 0 && line.live, "walking to the zero table") ;
+	CHECK(line.compressed && line.len < sizeof(dat), "compressing the zero table") ;
+
+	CHECK(mount() == 0, "remounting") ;
+	memset(buf, 0xA5, sizeof(buf)) ;
+	CHECK(g_read_nvmm_len(TEST_ID_COMPRESSED, buf, sizeof(buf), &len) == 0 && len == sizeof(dat) && \
+		memcmp(buf, dat, sizeof(dat)) == 0, "reading the zero table back") ;
+
+	CHECK(g_defrag_nvmm() == 0 && is_item(TEST_ID_COMPRESSED, dat, sizeof(dat)), "reading the zero table after a defrag") ;
+}
+
+
+/*
+ * the same value under another id is a reference, it reads back through the defrag
+ * and after the value of the original id changes.
+ */
+static void test_dedup(void)
+{
+	uint8_t dat[100] ;
+	uint8_t other[100] ;
+	nvmm_lineinfo_t line ;
+	nvmm_info_t before, after ;
+
+	fill(dat, sizeof(dat), TEST_ID_ORIGINAL, 0) ;
+	fill(other, sizeof(other), TEST_ID_ORIGINAL, 1) ;
+	g_dedup_nvmm(1) ;
+	CHECK(g_write_nvmm(TEST_ID_ORIGINAL, sizeof(dat), dat) == 0 && g_write_nvmm(TEST_ID_COPY, sizeof(dat), dat) == 0, \
+		"writing a value twice") ;
+
+	memset(&line, 0, sizeof(line)) ;
+	line.id = TEST_ID_COPY ;
+	CHECK(g_walk_nvmm(find_line, &line) == 0 && line.live && line.reference, "referring to the first copy") ;
+
+	//the same value again is not written, a different one is.
+	g_nvmm_info(&before) ;
+	CHECK(g_write_nvmm(TEST_ID_COPY, sizeof(dat), dat) == 0, "writing the same value over the reference") ;
+	g_nvmm_info(&after) ;
+	CHECK(after.used == before.used, "skipping an unchanged value") ;
+	other[0] = dat[0] ;
+	CHECK(g_write_nvmm(TEST_ID_ORIGINAL, sizeof(other), other) == 0, "changing the original value") ;
+	g_dedup_nvmm(0) ;
+
+	CHECK(is_item(TEST_ID_COPY, dat, sizeof(dat)) && is_item(TEST_ID_ORIGINAL, other, sizeof(other)), \
+		"reading both values back") ;
+	CHECK(g_defrag_nvmm() == 0 && mount() == 0, "defragging and remounting") ;
+	CHECK(is_item(TEST_ID_COPY, dat, sizeof(dat)) && is_item(TEST_ID_ORIGINAL, other, sizeof(other)), \
+		"reading both values back after a defrag") ;
+}
+
+
+/*
+ * a write, and then a defrag, are cut at every program and erase in turn,
+ * after the remount the item is either the former value or the new one, and the other items are untouched.
+ * the header is committed in stages for units up to a word, a cut between two stages must leave the former value.
+ * with the cache, the item is read before the write, the write and every remount must drop what was cached.
+ */
+static void test_power_cut(void)
+{
+	uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	uint8_t former[TEST_VALUE_MAXLENGTH] ;
+	size_t len = cached? TEST_CUT_CACHED_LENGTH : TEST_CUT_LENGTH ;
+	uint16_t id ;
+	long cut ;
+	int step ;
+	int ok = 1 ;
+	volatile int done = 0 ;
+
+	for(id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, 0) ;
+		g_write_nvmm(id, LENGTH(id), dat) ;
+	}
+	fill(former, len, TEST_ID_CUT, 0) ;
+	g_write_nvmm(TEST_ID_CUT, len, former) ;
+	memcpy(snapshot, ramflash_data(), sizeof(snapshot)) ;
+
+	for(step=0;step<2 && ok;step++)
+	{
+		for(cut=0,done=0;!done && ok;cut++)
+		{
+			memcpy(ramflash_data(), snapshot, sizeof(snapshot)) ;
+			if(mount() != 0 || !is_item(TEST_ID_CUT, former, len))
+			{
+				ok = 0 ;
+				break ;
+			}
+
+			budget = cut ;
+			fill(dat, len, TEST_ID_CUT, 1) ;
+			if(setjmp(power_cut) == 0)
+			{
+				if(step == 0)
+				{//a write, its line may go in a stage at a time.
+					g_write_nvmm(TEST_ID_CUT, len, dat) ;
+				}
+				else
+				{
+					g_defrag_nvmm() ;
+				}
+				done = 1 ;
+			}
+			if(done)
+			{//read back before the remount too.
+				ok = is_item(TEST_ID_CUT, (step == 0)? dat : former, len) ;
+			}
+
+			CHECK(mount() == 0, "remounting after a power cut") ;
+			for(id=0;id<TEST_ID_NUM && ok;id++)
+			{
+				fill(dat, LENGTH(id), id, 0) ;
+				ok = is_item(id, dat, LENGTH(id)) ;
+			}
+			//the item read last stays cached for the next remount.
+			fill(dat, len, TEST_ID_CUT, 1) ;
+			if(step == 0)
+			{//the new value once the write returned, either one before.
+				ok = ok && (is_item(TEST_ID_CUT, dat, len) || (!done && is_item(TEST_ID_CUT, former, len))) ;
+			}
+			else
+			{
+				ok = ok && is_item(TEST_ID_CUT, former, len) ;
+			}
+		}
+		CHECK(ok, (step == 0)? "cutting a write" : "cutting a defrag") ;
+		if(!ok)
+		{
+			fprintf(stderr, "    cut at program or erase %ld.\n", cut - 1) ;
+		}
+	}
+}
+
+
+/*
+ * a value streamed in pieces reads back once closed, readers see the former value until then,
+ * and a stream closed short is dropped.
+ */
+static void test_stream(void)
+{
+	static uint8_t dat[TEST_STREAM_LENGTH] ;
+	static uint8_t former[TEST_STREAM_LENGTH] ;
+
+	fill(former, sizeof(former), TEST_ID_STREAM, 0) ;
+	fill(dat, sizeof(dat), TEST_ID_STREAM, 1) ;
+	CHECK(stream_item(TEST_ID_STREAM, former, sizeof(former)) == 0 && is_item(TEST_ID_STREAM, former, sizeof(former)), \
+		"streaming a value") ;
+
+	CHECK(g_open_nvmm(TEST_ID_STREAM, sizeof(dat)) == 0 && g_append_nvmm(dat, 333) == 0, "opening a stream") ;
+	CHECK(is_item(TEST_ID_STREAM, former, sizeof(former)), "reading the former value while the stream is open") ;
+	CHECK(g_write_nvmm(TEST_ID_STREAM + 1, 4, dat) != 0 && g_defrag_nvmm() != 0, "refusing writes while the stream is open") ;
+	CHECK(g_append_nvmm(dat + 333, sizeof(dat) - 333 + 1) != 0, "refusing a piece over the length") ;
+	CHECK(g_append_nvmm(dat + 333, sizeof(dat) - 333) == 0 && g_close_nvmm() == 0, "closing the stream") ;
+	CHECK(is_item(TEST_ID_STREAM, dat, sizeof(dat)), "reading the streamed value back") ;
+
+	CHECK(g_open_nvmm(TEST_ID_STREAM, sizeof(former)) == 0 && g_append_nvmm(former, 100) == 0 && g_close_nvmm() != 0, \
+		"dropping a stream closed short") ;
+	CHECK(is_item(TEST_ID_STREAM, dat, sizeof(dat)), "reading the value back after a dropped stream") ;
+	CHECK(g_defrag_nvmm() == 0 && mount() == 0 && is_item(TEST_ID_STREAM, dat, sizeof(dat)), \
+		"reading the streamed value back after a defrag and a remount") ;
+}
+
+
+/*
+ * read the item of id from offset to its end in chunks through a cursor, and check it's dat from there.
+ */
+static int is_cursor(uint16_t id, size_t offset, const uint8_t* dat, size_t len)
+{
+	uint8_t buf[TEST_CURSOR_CHUNK] ;
+	nvmm_cursor_t cursor ;
+	size_t chunk ;
+
+	if(g_open_nvmm_cursor(&cursor, id, offset) != 0)
+	{
+		return 0 ;
+	}
+	for(;offset<len;offset+=chunk)
+	{
+		chunk = (len - offset < sizeof(buf))? len - offset : sizeof(buf) ;
+		if(g_read_nvmm_cursor(&cursor, buf, chunk) != 0 || memcmp(buf, dat + offset, chunk) != 0)
+		{
+			return 0 ;
+		}
+	}
+
+	return g_read_nvmm_cursor(&cursor, buf, 1) != 0 ;
+}
+
+
+/*
+ * reads at an offset and cursors read a plain and a compressed item from inside,
+ * a cursor keeps reading the value it was opened on until a defrag puts it out of date.
+ */
+static void test_cursor(void)
+{
+	static uint8_t dat[TEST_STREAM_LENGTH] ;
+	static uint8_t other[TEST_STREAM_LENGTH] ;
+	uint8_t buf[TEST_CURSOR_CHUNK] ;
+	nvmm_cursor_t cursor ;
+	nvmm_lineinfo_t line ;
+	size_t i ;
+
+	fill(dat, sizeof(dat), TEST_ID_CURSOR, 0) ;
+	fill(other, sizeof(other), TEST_ID_CURSOR, 1) ;
+	CHECK(g_write_nvmm(TEST_ID_CURSOR, sizeof(dat), dat) == 0, "writing a value") ;
+	CHECK(g_read_nvmm_at(TEST_ID_CURSOR, 501, 37, buf, sizeof(buf)) == 0 && memcmp(buf, dat + 501, 37) == 0, \
+		"reading at an offset") ;
+	CHECK(g_read_nvmm_at(TEST_ID_CURSOR, sizeof(dat) - 10, 11, buf, sizeof(buf)) != 0, "refusing a read over the item") ;
+	CHECK(is_cursor(TEST_ID_CURSOR, 0, dat, sizeof(dat)) && is_cursor(TEST_ID_CURSOR, 123, dat, sizeof(dat)), \
+		"reading through a cursor") ;
+
+	CHECK(g_open_nvmm_cursor(&cursor, TEST_ID_CURSOR, 200) == 0, "opening a cursor") ;
+	CHECK(g_write_nvmm(TEST_ID_CURSOR, sizeof(other), other) == 0, "writing over the cursor") ;
+	CHECK(g_read_nvmm_cursor(&cursor, buf, sizeof(buf)) == 0 && memcmp(buf, dat + 200, sizeof(buf)) == 0, \
+		"reading the value the cursor was opened on") ;
+	CHECK(g_defrag_nvmm() == 0 && g_read_nvmm_cursor(&cursor, buf, sizeof(buf)) != 0, "putting the cursor out of date") ;
+	CHECK(is_cursor(TEST_ID_CURSOR, 77, other, sizeof(other)), "reading through a cursor after a defrag") ;
+
+	for(i=0;i<sizeof(dat);i++)
+	{//redundant, so it's compressed.
+		dat[i] = (uint8_t)(i % 16) ;
+	}
+	g_compress_nvmm(compress_all) ;
+	CHECK(g_write_nvmm(TEST_ID_CURSOR, sizeof(dat), dat) == 0, "writing a compressed value") ;
+	g_compress_nvmm(0) ;
+	memset(&line, 0, sizeof(line)) ;
+	line.id = TEST_ID_CURSOR ;
+	CHECK(g_walk_nvmm(find_line, &line) == 0 && line.live && line.compressed, "compressing the value") ;
+	CHECK(g_read_nvmm_at(TEST_ID_CURSOR, 601, 37, buf, sizeof(buf)) == 0 && memcmp(buf, dat + 601, 37) == 0, \
+		"reading a compressed value at an offset") ;
+	CHECK(mount() == 0 && is_cursor(TEST_ID_CURSOR, 45, dat, sizeof(dat)), \
+		"reading a compressed value through a cursor after a remount") ;
+}
+
+
+static uint8_t classify_test(uint16_t id)
+{
+	return (id == TEST_ID_HOT)? NVMM_CLASS_HOT : (id == TEST_ID_COLD)? NVMM_CLASS_COLD : NVMM_CLASS_AUTO ;
+}
+
+
+static int mount_cold(void)
+{
+	if(mount() != 0)
+	{
+		return -1 ;
+	}
+
+	return g_init_nvmm_cold(TEST_PAGE_COLD_A, TEST_PAGE_COLD_B, classify_test) ;
+}
+
+
+/*
+ * check the live line of id is in the cold group.
+ */
+static int is_cold(uint16_t id)
+{
+	nvmm_lineinfo_t line ;
+
+	memset(&line, 0, sizeof(line)) ;
+	line.id = id ;
+	g_walk_nvmm(find_line, &line) ;
+
+	return line.live && line.address >= TEST_PAGE_COLD_A * TEST_PAGE_SIZE ;
+}
+
+
+/*
+ * a cold item goes to the cold group at once, a hot one never, an auto one once it's not written between two defrags.
+ * what the last defrag settled isn't known after a remount, an item takes two more defrags to move then.
+ */
+static void test_cold(void)
+{
+	uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	uint16_t id ;
+	int ok ;
+
+	CHECK(g_init_nvmm_cold(TEST_PAGE_COLD_A, TEST_PAGE_COLD_B, classify_test) == 0, "mounting the cold group") ;
+	for(ok=1,id=0;id<=TEST_ID_COLD;id++)
+	{
+		fill(dat, LENGTH(id), id, 0) ;
+		ok = ok && (g_write_nvmm(id, LENGTH(id), dat) == 0) ;
+	}
+	CHECK(ok, "writing the items") ;
+	CHECK(is_cold(TEST_ID_COLD) && !is_cold(0), "writing a cold item to the cold group") ;
+
+	CHECK(g_defrag_nvmm() == 0 && !is_cold(0), "keeping the items written before the first defrag") ;
+	fill(dat, LENGTH(1), 1, 1) ;
+	CHECK(g_write_nvmm(1, LENGTH(1), dat) == 0 && g_defrag_nvmm() == 0, "rewriting an item and defragging") ;
+	for(ok=1,id=0;id<TEST_ID_AUTO_NUM;id++)
+	{
+		ok = ok && (is_cold(id) == (id != 1)) ;
+	}
+	CHECK(ok && !is_cold(TEST_ID_HOT), "moving the settled items to the cold group") ;
+
+	CHECK(mount_cold() == 0 && g_defrag_nvmm() == 0 && !is_cold(1), "forgetting the settled items over a remount") ;
+	CHECK(g_defrag_nvmm() == 0 && is_cold(1) && !is_cold(TEST_ID_HOT), "moving the item settled after the remount") ;
+
+	CHECK(mount_cold() == 0, "remounting") ;
+	for(ok=1,id=0;id<=TEST_ID_COLD;id++)
+	{
+		fill(dat, LENGTH(id), id, (id == 1)? 1 : 0) ;
+		ok = ok && is_item(id, dat, LENGTH(id)) ;
+	}
+	CHECK(ok, "reading the items back from both groups") ;
+}
+
+
+/*
+ * live lines counted by a walk.
+ */
+typedef struct{
+	uint32_t live ;
+	uint32_t indexed ;
+	uint32_t reads ;		//the most reads a lookup takes to one of them.
+}test_lines_t ;
+
+static int count_lines(const nvmm_lineinfo_t* line, void* arg)
+{
+	test_lines_t* lines = (test_lines_t* )arg ;
+
+	if(line->live)
+	{
+		lines->live++ ;
+		lines->indexed += line->indexed ;
+		lines->reads = (line->reads > lines->reads)? line->reads : lines->reads ;
+	}
+
+	return 0 ;
+}
+
+
+/*
+ * a defrag writes an index line of the lines it copies, a lookup binary searches it
+ * instead of walking down every line, the lines written after it are walked down to it.
+ */
+static void test_index(void)
+{
+	uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	test_lines_t lines ;
+	uint16_t id ;
+	int ok ;
+
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, 0) ;
+		ok = ok && (g_write_nvmm(id, LENGTH(id), dat) == 0) ;
+	}
+	CHECK(ok, "writing the items") ;
+	memset(&lines, 0, sizeof(lines)) ;
+	CHECK(g_walk_nvmm(count_lines, &lines) == 0 && lines.live == TEST_ID_NUM && lines.indexed == 0, \
+		"walking the lines before a defrag") ;
+
+	memset(&lines, 0, sizeof(lines)) ;
+	CHECK(g_defrag_nvmm() == 0 && g_walk_nvmm(count_lines, &lines) == 0 && lines.indexed == TEST_ID_NUM, \
+		"indexing the lines on a defrag") ;
+	CHECK(lines.reads < TEST_ID_NUM / 2, "binary searching the index") ;
+
+	fill(dat, LENGTH(0), 0, 1) ;
+	memset(&lines, 0, sizeof(lines)) ;
+	CHECK(g_write_nvmm(0, LENGTH(0), dat) == 0 && g_walk_nvmm(count_lines, &lines) == 0 && \
+		lines.live == TEST_ID_NUM && lines.indexed == TEST_ID_NUM - 1, "walking down to the index") ;
+
+	CHECK(mount() == 0, "remounting") ;
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, (id == 0)? 1 : 0) ;
+		ok = ok && is_item(id, dat, LENGTH(id)) ;
+	}
+	CHECK(ok, "reading the items back through the index") ;
+}
+
+
+/*
+ * with checkpoints, an index line follows every few lines written, before and after a remount,
+ * so no more than that many lines are walked down to an index.
+ */
+static void test_checkpoint(void)
+{
+	uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	test_lines_t lines ;
+	uint32_t round ;
+	uint16_t id ;
+	int ok = 1 ;
+
+	g_checkpoint_nvmm(TEST_CHECKPOINT) ;
+	for(round=0;round<2;round++)
+	{
+		for(id=0;id<TEST_ID_NUM;id++)
+		{
+			fill(dat, LENGTH(id), id, round) ;
+			ok = ok && (g_write_nvmm(id, LENGTH(id), dat) == 0) ;
+		}
+		memset(&lines, 0, sizeof(lines)) ;
+		CHECK(ok && g_walk_nvmm(count_lines, &lines) == 0 && lines.live == TEST_ID_NUM, "writing the items") ;
+		CHECK(lines.indexed > 0 && lines.live - lines.indexed < TEST_CHECKPOINT, "indexing every few lines") ;
+		CHECK(mount() == 0, "remounting") ;
+	}
+
+	//the lines since the last index are counted on the mount.
+	ok = (g_defrag_nvmm() == 0) ;
+	for(round=2;round<TEST_CHECKPOINT+1;round++)
+	{
+		fill(dat, LENGTH(0), 0, round) ;
+		ok = ok && (g_write_nvmm(0, LENGTH(0), dat) == 0) ;
+	}
+	memset(&lines, 0, sizeof(lines)) ;
+	CHECK(ok && g_walk_nvmm(count_lines, &lines) == 0 && lines.indexed == TEST_ID_NUM - 1, "writing up to a checkpoint") ;
+	fill(dat, LENGTH(0), 0, round) ;
+	CHECK(mount() == 0 && g_write_nvmm(0, LENGTH(0), dat) == 0, "writing over a remount") ;
+	memset(&lines, 0, sizeof(lines)) ;
+	CHECK(g_walk_nvmm(count_lines, &lines) == 0 && lines.indexed == TEST_ID_NUM, "writing a checkpoint after a remount") ;
+	g_checkpoint_nvmm(0) ;
+
+	CHECK(mount() == 0, "remounting") ;
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, (id == 0)? round : 1) ;
+		ok = ok && is_item(id, dat, LENGTH(id)) ;
+	}
+	CHECK(ok, "reading the items back through the checkpoints") ;
+}
+
+
+/*
+ * read the ids never written from TEST_ID_UNWRITTEN + 1 on.
+ * will return how many of them read the flash, -1 if one is found.
+ */
+static int probe_unwritten(void)
+{
+	uint8_t buf[8] ;
+	uint32_t reads ;
+	size_t len ;
+	int touched = 0 ;
+	int i ;
+
+	for(i=1;i<=TEST_PROBES;i++)
+	{
+		reads = flash_reads ;
+		if(g_read_nvmm_len(TEST_ID_UNWRITTEN + i, buf, sizeof(buf), &len) == 0)
+		{
+			return -1 ;
+		}
+		touched += (flash_reads != reads) ;
+	}
+
+	return touched ;
+}
+
+
+/*
+ * with a bloom filter, reading an id never written doesn't go to the flash but now and then,
+ * the filter is built when it's set and on every mount, from the index and the lines since, and set on every write.
+ */
+static void test_bloom(void)
+{
+	static uint8_t bits[64] ;
+	uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	uint16_t id ;
+	int touched ;
+	int ok ;
+
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, 0) ;
+		ok = ok && (g_write_nvmm(id, LENGTH(id), dat) == 0) ;
+	}
+	CHECK(ok, "writing the items") ;
+	CHECK(probe_unwritten() == TEST_PROBES, "reading ids never written without a filter") ;
+
+	g_bloom_nvmm(bits, sizeof(bits)) ;
+	touched = probe_unwritten() ;
+	CHECK(touched >= 0 && touched < TEST_PROBES / 10, "filtering ids never written") ;
+	fill(dat, 8, TEST_ID_UNWRITTEN, 0) ;
+	CHECK(g_write_nvmm(TEST_ID_UNWRITTEN, 8, dat) == 0 && is_item(TEST_ID_UNWRITTEN, dat, 8), \
+		"reading an id written after the filter is built") ;
+
+	//after the remount the id is in the index, and a new value in the lines since.
+	fill(dat, 8, TEST_ID_UNWRITTEN, 1) ;
+	CHECK(g_defrag_nvmm() == 0 && g_write_nvmm(TEST_ID_UNWRITTEN, 8, dat) == 0 && mount() == 0, \
+		"defragging and remounting") ;
+	touched = probe_unwritten() ;
+	CHECK(touched >= 0 && touched < TEST_PROBES / 10, "filtering ids never written after a remount") ;
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, 0) ;
+		ok = ok && is_item(id, dat, LENGTH(id)) ;
+	}
+	fill(dat, 8, TEST_ID_UNWRITTEN, 1) ;
+	CHECK(ok && is_item(TEST_ID_UNWRITTEN, dat, 8), "reading the items back through the filter") ;
+	g_bloom_nvmm(0, 0) ;
+}
+
+
+static uint32_t shadow_fills = 0 ;
+
+static int fill_shadow(uint32_t address, uint8_t* buf, size_t bufsize, size_t datlen)
+{
+	shadow_fills++ ;
+
+	return ramflash_read(address, buf, bufsize, datlen) ;
+}
+
+
+/*
+ * with a RAM shadow of the active page, the items are read without reading the flash,
+ * the shadow follows the writes and is filled again on every defrag and mount.
+ */
+static void test_shadow(void)
+{
+	static uint8_t ram[TEST_PAGE_SIZE] ;
+	uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	uint32_t round ;
+	uint32_t reads ;
+	uint16_t id ;
+	nvmm_wear_t wear ;
+	int ok = 1 ;
+
+	CHECK(g_shadow_nvmm(ram, sizeof(ram) - 1, 0) != 0, "refusing a shadow less than a page") ;
+	shadow_fills = 0 ;
+	CHECK(g_shadow_nvmm(ram, sizeof(ram), fill_shadow) == 0 && shadow_fills > 0, "filling the shadow") ;
+	for(round=0;round<TEST_ROUNDS;round++)
+	{
+		for(id=0;id<TEST_ID_NUM;id++)
+		{
+			fill(dat, LENGTH(id), id, round) ;
+			ok = ok && (g_write_nvmm(id, LENGTH(id), dat) == 0) ;
+		}
+	}
+	CHECK(ok && g_nvmm_wear(0, 0, &wear) == 0 && wear.defrags > 0, "rewriting the items over a defrag") ;
+
+	reads = flash_reads ;
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, round - 1) ;
+		ok = ok && is_item(id, dat, LENGTH(id)) ;
+	}
+	CHECK(ok, "reading the items back from the shadow") ;
+	CHECK(flash_reads == reads, "leaving the flash alone on reads") ;
+
+	shadow_fills = 0 ;
+	CHECK(mount() == 0 && shadow_fills > 0, "filling the shadow on a remount") ;
+	reads = flash_reads ;
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, round - 1) ;
+		ok = ok && is_item(id, dat, LENGTH(id)) ;
+	}
+	CHECK(ok && flash_reads == reads, "reading the items back from the shadow after a remount") ;
+	g_shadow_nvmm(0, 0, 0) ;
+}
+
+
+/*
+ * check the items of round, and the item of TEST_ID_CUT.
+ */
+static int is_round(uint32_t round, const uint8_t* cut)
+{
+	uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	uint16_t id ;
+
+	for(id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, round) ;
+		if(!is_item(id, dat, LENGTH(id)))
+		{
+			return 0 ;
+		}
+	}
+
+	return is_item(TEST_ID_CUT, cut, TEST_CUT_LENGTH) ;
+}
+
+
+/*
+ * mount and count the flash reads it takes.
+ */
+static uint32_t mount_reads(void)
+{
+	uint32_t reads = flash_reads ;
+
+	if(mount() != 0)
+	{
+		return 0xFFFFFFFF ;
+	}
+
+	return flash_reads - reads ;
+}
+
+
+/*
+ * with the mount state retained, a remount takes it instead of scanning the pages,
+ * a broken or out of date state and a power cut while programming mount from the flash.
+ */
+static void test_retain(void)
+{
+	static nvmm_retain_t block ;
+	nvmm_retain_t kept ;
+	uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	uint8_t cut[TEST_CUT_LENGTH] ;
+	uint32_t round ;
+	uint32_t warm ;
+	uint32_t cold ;
+	uint16_t id ;
+	int ok = 1 ;
+
+	memset(&block, 0, sizeof(block)) ;
+	g_retain_nvmm(&block) ;
+	fill(cut, sizeof(cut), TEST_ID_CUT, 0) ;
+	for(round=0;round<TEST_ROUNDS;round++)
+	{
+		for(id=0;id<TEST_ID_NUM;id++)
+		{
+			fill(dat, LENGTH(id), id, round) ;
+			ok = ok && (g_write_nvmm(id, LENGTH(id), dat) == 0) ;
+		}
+	}
+	round-- ;
+	CHECK(ok && g_write_nvmm(TEST_ID_CUT, sizeof(cut), cut) == 0, "rewriting the items over a defrag") ;
+
+	warm = mount_reads() ;
+	CHECK(warm != 0xFFFFFFFF && is_round(round, cut), "reading the items back after a warm remount") ;
+	block.check ^= 1 ;
+	cold = mount_reads() ;
+	CHECK(cold != 0xFFFFFFFF && is_round(round, cut), "reading the items back after a remount from the flash") ;
+	CHECK(warm < cold, "taking the retained state") ;
+
+	//a copy kept before a write is out of date after it.
+	kept = block ;
+	fill(cut, sizeof(cut), TEST_ID_CUT, 1) ;
+	CHECK(g_write_nvmm(TEST_ID_CUT, sizeof(cut), cut) == 0, "writing after the state is kept") ;
+	block = kept ;
+	CHECK(mount_reads() > warm && is_round(round, cut), "mounting from the flash with an out of date state") ;
+
+	//a power cut in the middle of a write leaves the state marked out of date.
+	fill(dat, sizeof(cut), TEST_ID_CUT, 2) ;
+	budget = 1 ;
+	if(setjmp(power_cut) == 0)
+	{
+		g_write_nvmm(TEST_ID_CUT, sizeof(cut), dat) ;
+	}
+	cold = mount_reads() ;
+	CHECK(cold > warm && (is_round(round, cut) || is_round(round, dat)), "mounting from the flash after a power cut") ;
+	//a line left half programmed stays in the way until a defrag.
+	CHECK(g_defrag_nvmm() == 0 && mount_reads() == warm && (is_round(round, cut) || is_round(round, dat)), \
+		"taking the state kept after a defrag") ;
+	g_retain_nvmm(0) ;
+}
+
+
+/*
+ * rewrite the items of round and the item of TEST_ID_CUT, and read each one back right after.
+ */
+static int write_round(uint32_t round, const uint8_t* cut)
+{
+	uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	uint16_t id ;
+
+	for(id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, round) ;
+		if(g_write_nvmm(id, LENGTH(id), dat) != 0 || !is_item(id, dat, LENGTH(id)))
+		{
+			return 0 ;
+		}
+	}
+
+	return g_write_nvmm(TEST_ID_CUT, TEST_CUT_LENGTH, (void* )cut) == 0 && is_item(TEST_ID_CUT, cut, TEST_CUT_LENGTH) ;
+}
+
+
+/*
+ * with a readahead window, the header scans take fewer reads and the window follows the programs and erases.
+ */
+static void test_scan(void)
+{
+	static uint8_t ram[TEST_SCAN_SIZE] ;
+	uint8_t cut[TEST_CUT_LENGTH] ;
+	uint32_t round ;
+	uint32_t reads ;
+	int ok = 1 ;
+
+	fill(cut, sizeof(cut), TEST_ID_CUT, 0) ;
+	for(round=0;round<TEST_ROUNDS && ok;round++)
+	{
+		ok = write_round(round, cut) ;
+	}
+	CHECK(ok, "rewriting the items") ;
+
+	CHECK(g_scan_nvmm(0, sizeof(ram)) != 0, "refusing a window without RAM") ;
+	reads = mount_reads() ;
+	CHECK(g_scan_nvmm(ram, sizeof(ram)) == 0 && mount_reads() < reads, "mounting through the window") ;
+
+	for(ok=1;round<TEST_ROUNDS*2 && ok;round++)
+	{
+		fill(cut, sizeof(cut), TEST_ID_CUT, round) ;
+		ok = write_round(round, cut) ;
+	}
+	CHECK(ok, "rewriting the items through the window") ;
+	CHECK(is_round(round - 1, cut), "reading the items back through the window") ;
+	CHECK(g_defrag_nvmm() == 0 && is_round(round - 1, cut), "reading the items back after a defrag") ;
+	CHECK(mount() == 0 && is_round(round - 1, cut), "reading the items back after a remount") ;
+	g_scan_nvmm(0, 0) ;
+}
+
+
+/*
+ * readv needs writev, and with writev alone the programs are read back by the scalar method.
+ */
+static void test_vector(void)
+{
+	uint8_t cut[TEST_CUT_LENGTH] ;
+	uint32_t calls = vector_calls ;
+
+	fill(cut, sizeof(cut), TEST_ID_CUT, 0) ;
+	CHECK(g_vector_nvmm(count_readv, 0) != 0, "refusing readv without writev") ;
+	CHECK(write_round(0, cut) && vector_calls > calls, "writing the items through the vectored methods") ;
+
+	g_vector_nvmm(0, cut_writev) ;
+	calls = vector_calls ;
+	fill(cut, sizeof(cut), TEST_ID_CUT, 1) ;
+	CHECK(write_round(1, cut) && vector_calls > calls, "writing the items through writev alone") ;
+	CHECK(g_defrag_nvmm() == 0 && mount() == 0 && is_round(1, cut), "reading the items back after a remount") ;
+}
+
+
+/*
+ * a short value read is cached, writing it drops it and so does closing a stream of it.
+ * a defrag keeps the cached values, they must still be the ones on the flash.
+ * mounting the cold group drops them all.
+ */
+static void test_cache(void)
+{
+	nvmm_cache_t kept[TEST_CACHE_NUM] ;
+	uint8_t dat[8] ;
+	uint8_t other[8] ;
+	size_t i ;
+	int ok ;
+
+	fill(dat, sizeof(dat), TEST_ID_CACHED, 0) ;
+	fill(other, sizeof(other), TEST_ID_CACHED, 1) ;
+	CHECK(g_write_nvmm(TEST_ID_CACHED, sizeof(dat), dat) == 0 && is_item(TEST_ID_CACHED, dat, sizeof(dat)), \
+		"reading a short value back") ;
+	CHECK(is_cached(TEST_ID_CACHED), "caching a short value") ;
+	CHECK(g_write_nvmm(TEST_ID_CACHED, sizeof(other), other) == 0 && !is_cached(TEST_ID_CACHED), \
+		"dropping the cached value on a write") ;
+	CHECK(is_item(TEST_ID_CACHED, other, sizeof(other)), "reading the value written back") ;
+
+	CHECK(g_open_nvmm(TEST_ID_CACHED, sizeof(dat)) == 0 && is_item(TEST_ID_CACHED, other, sizeof(other)), \
+		"reading the former value while the stream is open") ;
+	CHECK(g_append_nvmm(dat, 3) == 0 && g_append_nvmm(dat + 3, sizeof(dat) - 3) == 0 && g_close_nvmm() == 0, \
+		"streaming a new value") ;
+	CHECK(is_item(TEST_ID_CACHED, dat, sizeof(dat)), "reading the streamed value back") ;
+
+	CHECK(g_write_nvmm(TEST_ID_CACHED + 1, 2, other) == 0 && is_item(TEST_ID_CACHED + 1, other, 2), \
+		"reading an inline value back") ;
+	CHECK(g_defrag_nvmm() == 0 && is_item(TEST_ID_CACHED, dat, sizeof(dat)) && is_item(TEST_ID_CACHED + 1, other, 2), \
+		"reading the values back after a defrag") ;
+	memcpy(kept, cache, sizeof(kept)) ;
+	CHECK(mount() == 0, "remounting") ;
+	for(ok=1,i=0;i<TEST_CACHE_NUM;i++)
+	{
+		ok = ok && (kept[i].used == 0 || is_item(kept[i].id, kept[i].value, kept[i].len)) ;
+	}
+	CHECK(ok, "keeping the cache in step with the flash over a defrag") ;
+
+	CHECK(is_item(TEST_ID_CACHED, dat, sizeof(dat)) && is_cached(TEST_ID_CACHED), "caching a value again") ;
+	CHECK(g_init_nvmm_cold(TEST_PAGE_COLD_A, TEST_PAGE_COLD_B, 0) == 0, "mounting the cold group") ;
+	for(ok=1,i=0;i<TEST_CACHE_NUM;i++)
+	{
+		ok = ok && (cache[i].used == 0) ;
+	}
+	CHECK(ok, "dropping the cache on mounting the cold group") ;
+	CHECK(is_item(TEST_ID_CACHED, dat, sizeof(dat)), "reading the value back with the cold group") ;
+}
+
+
+/*
+ * the file backend programs the unit it's opened with, the items read back after the file is reopened.
+ */
+static int mount_file(void)
+{
+	if(nvmm_file_open(path, TEST_PAGE_A * TEST_PAGE_SIZE, 2 * TEST_PAGE_SIZE, TEST_PAGE_SIZE, geometry.program_unit, 0) != 0)
+	{
+		return -1 ;
+	}
+
+	return g_init_nvmm_geometry(nvmm_file_read, nvmm_file_write, nvmm_file_erase, TEST_PAGE_A, TEST_PAGE_B, &geometry) ;
+}
+
+static void test_file(void)
+{
+	uint8_t dat[TEST_VALUE_MAXLENGTH] ;
+	uint16_t id ;
+	int ok ;
+
+	unlink(path) ;
+	CHECK(mount_file() == 0, "mounting a new file") ;
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, 0) ;
+		ok = ok && (g_write_nvmm(id, LENGTH(id), dat) == 0) ;
+	}
+	CHECK(ok, "writing the items to the file") ;
+
+	nvmm_file_close() ;
+	CHECK(mount_file() == 0, "reopening the file") ;
+	for(ok=1,id=0;id<TEST_ID_NUM;id++)
+	{
+		fill(dat, LENGTH(id), id, 0) ;
+		ok = ok && is_item(id, dat, LENGTH(id)) ;
+	}
+	CHECK(ok, "reading the items back from the file") ;
+
+	nvmm_file_close() ;
+	unlink(path) ;
+}
+
+
+/*
+ * every test starts on a blank flash.
+ */
+static void run_tests(void (* const tests[])(void), size_t num)
+{
+	size_t i ;
+
+	for(i=0;i<num;i++)
+	{
+		if(blank() != 0)
+		{
+			CHECK(0, "mounting a blank flash") ;
+			break ;
+		}
+		(* tests[i])() ;
+	}
+}
+
+
+static void run(uint32_t unit, uint32_t format)
+{
+	static void (* const tests[])(void) = {test_roundtrip, test_compress, test_dedup, test_power_cut, test_stream, \
+		test_cursor, test_cold, test_index, test_checkpoint, test_bloom, test_shadow, test_retain, test_scan} ;
+	static void (* const cached_tests[])(void) = {test_roundtrip, test_power_cut, test_cache} ;
+	static void (* const vectored_tests[])(void) = {test_roundtrip, test_power_cut, test_vector} ;
+
+	memset(&geometry, 0, sizeof(geometry)) ;
+	geometry.page_size = TEST_PAGE_SIZE ;
+	geometry.program_unit = unit ;
+	geometry.header_format = format ;
+
+	run_tests(tests, sizeof(tests)/sizeof(tests[0])) ;
+
+	cached = 1 ;
+	run_tests(cached_tests, sizeof(cached_tests)/sizeof(cached_tests[0])) ;
+	cached = 0 ;
+	g_cache_nvmm(0, 0) ;
+
+	vectored = 1 ;
+	run_tests(vectored_tests, sizeof(vectored_tests)/sizeof(vectored_tests[0])) ;
+	vectored = 0 ;
+	g_vector_nvmm(0, 0) ;
+
+	ramflash_close() ;
+
+	test_file() ;
+}
+
+
+int main(void)
+{
+	size_t i ;
+	int fd ;
+
+	fd = mkstemp(path) ;
+	if(fd < 0)
+	{
+		perror(path) ;
+		return 1 ;
+	}
+	close(fd) ;
+
+	for(i=0;i<sizeof(units)/sizeof(units[0]);i++)
+	{
+		run(units[i], NVMM_HEADER_STANDARD) ;
+		if(units[i] <= sizeof(uint32_t))
+		{//the compact header is for units up to a word.
+			run(units[i], NVMM_HEADER_COMPACT) ;
+		}
+	}
+
+	printf("nvmm_test, %d bits: %s.\n", NVMM_ADDRESS_WIDTH, (failures == 0)? "passed" : "FAILED") ;
+
+	return (failures == 0)? 0 : 1 ;
+}
@@ -0,0 +1,126 @@
+/*
+ * File Name: ramflash.c
+ * Author: PROJECTSUGAR
+ * Description: 
+ * Host side RAM flash model for the NVMM tools.
+     Copyright 2017 PROJECTSUGAR
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include "ramflash.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static uint8_t* flash = 0 ;
+static size_t flash_size = 0 ;
+static uint32_t flash_page_size = 0 ;
+static uint32_t flash_program_unit = 4 ;
+
+
+int ramflash_open(uint16_t page_num, uint32_t page_size, uint32_t program_unit)
+{
+	ramflash_close() ;
+
+	if(page_num == 0 || page_size == 0 || program_unit == 0 || page_size % program_unit)
+	{
+		return -1 ;
+	}
+
+	flash_size = (size_t)page_num * page_size ;
+	flash = malloc(flash_size) ;
+	if(flash == 0)
+	{
+		flash_size = 0 ;
+		return -1 ;
+	}
+	memset(flash, 0xFF, flash_size) ;
+	flash_page_size = page_size ;
+	flash_program_unit = program_unit ;
+
+	return 0 ;
+}
+
+
+void ramflash_close(void)
+{
+	free(flash) ;
+	flash = 0 ;
+	flash_size = 0 ;
+}
+
+
+uint8_t* ramflash_data(void)
+{
+	return flash ;
+}
+
+
+size_t ramflash_size(void)
+{
+	return flash_size ;
+}
+
+
+int ramflash_read(uint32_t address, uint8_t* buf, size_t bufsize, size_t datlen)
+{
+	if(buf == 0 || bufsize == 0 || datlen == 0 || bufsize < datlen)
+	{
+		return -1 ;
+	}
+	if(address + datlen > flash_size)
+	{
+		return -1 ;
+	}
+
+	memcpy(buf, flash + address, datlen) ;
+
+	return 0 ;
+}
+
+
+int ramflash_write(uint32_t address, uint8_t* dat, size_t wordnum)
+{
+	size_t i ;
+
+	if(dat == 0 || wordnum == 0 || address % flash_program_unit)
+	{
+		return -1 ;
+	}
+	if(address + wordnum * flash_program_unit > flash_size)
+	{
+		return -1 ;
+	}
+
+	//NOR programming, bits can only go from 1 to 0.
+	for(i=0;i<wordnum*flash_program_unit;i++)
+	{
+		flash[address + i] &= dat[i] ;
+	}
+
+	return 0 ;
+}
+
+
+int ramflash_erase(uint32_t address)
+{
+	if(address % flash_page_size || address >= flash_size)
+	{
+		return -1 ;
+	}
+
+	memset(flash + address, 0xFF, flash_page_size) ;
+
+	return 0 ;
+}
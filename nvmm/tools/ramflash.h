@@ -0,0 +1,54 @@
+/*
+ * File Name: ramflash.h
+ * Author: PROJECTSUGAR
+ * Description: 
+ * Host side RAM flash model for the NVMM tools.
+ * It realizes the read, write and erase methods NVMM requires on top of a plain RAM buffer, 
+ * so the tools can run the same nvmm.c the firmware runs and get exactly the same flash layout.
+ * The model behaves like a NOR flash, programming can only clear bits and erasing sets a page to 0xFF.
+     Copyright 2017 PROJECTSUGAR
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef __RAMFLASH_H__
+#define __RAMFLASH_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * create a blank(0xFF) flash with page_num pages of page_size bytes,
+ * programmed in units of program_unit bytes, the same unit given to NVMM in nvmm_geometry_t.
+ * will return 0 for success, -1 for something error.
+ */
+int ramflash_open(uint16_t page_num, uint32_t page_size, uint32_t program_unit) ;
+
+/*
+ * release the flash buffer.
+ */
+void ramflash_close(void) ;
+
+/*
+ * raw access to the flash content, for loading and dumping images.
+ */
+uint8_t* ramflash_data(void) ;
+size_t ramflash_size(void) ;
+
+/*
+ * NVMM flash operating methods.
+ */
+int ramflash_read(uint32_t address, uint8_t* buf, size_t bufsize, size_t datlen) ;
+int ramflash_write(uint32_t address, uint8_t* dat, size_t wordnum) ;
+int ramflash_erase(uint32_t address) ;
+
+#endif /* RAMFLASH.H */
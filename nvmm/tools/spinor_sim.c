@@ -0,0 +1,225 @@
+/*
+ * File Name: spinor_sim.c
+ * Author: PROJECTSUGAR
+ * Description: 
+ * Host side SPI NOR flash model for testing NVMM against external flash.
+     Copyright 2017 PROJECTSUGAR
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#include "spinor_sim.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define SPINOR_WORD_SIZE				4
+
+static uint8_t* chip = 0 ;
+static spinor_config_t chip_config ;
+static spinor_stats_t chip_stats ;
+
+
+void spinor_default_config(spinor_config_t* config, uint32_t size)
+{
+	config->size = size ;
+	config->sector_size = 4096 ;
+	config->page_size = 256 ;
+	config->command_ns = 2000 ;		//8bits opcode, 24bits address and 8 dummy cycles at 20MHz, plus driver overhead.
+	config->call_ns = 0 ;			//taken as part of the command.
+	config->byte_ns = 400 ;
+	config->program_ns = 700000 ;
+	config->erase_ns = 45000000 ;
+}
+
+
+int spinor_open(const spinor_config_t* config)
+{
+	spinor_close() ;
+
+	if(config == 0 || config->size == 0 || config->sector_size == 0 || config->page_size == 0 || \
+		config->size % config->sector_size || config->sector_size % config->page_size)
+	{
+		return -1 ;
+	}
+
+	chip = malloc(config->size) ;
+	if(chip == 0)
+	{
+		return -1 ;
+	}
+	memset(chip, 0xFF, config->size) ;
+	chip_config = *config ;
+	spinor_reset_stats() ;
+
+	return 0 ;
+}
+
+
+void spinor_close(void)
+{
+	free(chip) ;
+	chip = 0 ;
+}
+
+
+void spinor_get_stats(spinor_stats_t* stats)
+{
+	*stats = chip_stats ;
+}
+
+
+void spinor_reset_stats(void)
+{
+	memset(&chip_stats, 0, sizeof(chip_stats)) ;
+}
+
+
+/*
+ * a call to a method.
+ */
+static void spinor_call(void)
+{
+	chip_stats.calls++ ;
+	chip_stats.elapsed_ns += chip_config.call_ns ;
+}
+
+
+static int read_command(uint32_t address, uint8_t* buf, size_t bufsize, size_t datlen)
+{
+	if(chip == 0 || buf == 0 || bufsize == 0 || datlen == 0 || bufsize < datlen)
+	{
+		return -1 ;
+	}
+	if(address + datlen > chip_config.size)
+	{
+		return -1 ;
+	}
+
+	memcpy(buf, chip + address, datlen) ;
+
+	chip_stats.read_commands++ ;
+	chip_stats.read_bytes += datlen ;
+	chip_stats.elapsed_ns += chip_config.command_ns + (double)datlen * chip_config.byte_ns ;
+
+	return 0 ;
+}
+
+
+static int program_command(uint32_t address, uint8_t* dat, size_t wordnum)
+{
+	uint32_t page ;
+	uint32_t column ;
+	size_t len = wordnum * SPINOR_WORD_SIZE ;
+	size_t i ;
+
+	if(chip == 0 || dat == 0 || wordnum == 0 || address % SPINOR_WORD_SIZE)
+	{
+		return -1 ;
+	}
+	if(address + len > chip_config.size)
+	{
+		return -1 ;
+	}
+
+	page = address - address % chip_config.page_size ;
+	column = address % chip_config.page_size ;
+	if(column + len > chip_config.page_size)
+	{
+		chip_stats.page_wraps++ ;
+	}
+
+	//the column address wraps inside the page like a real chip does.
+	for(i=0;i<len;i++)
+	{
+		chip[page + (column + i) % chip_config.page_size] &= dat[i] ;
+	}
+
+	chip_stats.program_commands++ ;
+	chip_stats.program_bytes += len ;
+	chip_stats.elapsed_ns += chip_config.command_ns + (double)len * chip_config.byte_ns + chip_config.program_ns ;
+
+	return 0 ;
+}
+
+
+int spinor_erase(uint32_t address)
+{
+	spinor_call() ;
+	if(chip == 0 || address >= chip_config.size)
+	{
+		return -1 ;
+	}
+
+	if(address % chip_config.sector_size)
+	{//the chip ignores the low address bits.
+		chip_stats.misaligned++ ;
+	}
+	memset(chip + address - address % chip_config.sector_size, 0xFF, chip_config.sector_size) ;
+
+	chip_stats.erase_commands++ ;
+	chip_stats.elapsed_ns += chip_config.command_ns + chip_config.erase_ns ;
+
+	return 0 ;
+}
+
+
+int spinor_read(uint32_t address, uint8_t* buf, size_t bufsize, size_t datlen)
+{
+	spinor_call() ;
+
+	return read_command(address, buf, bufsize, datlen) ;
+}
+
+
+int spinor_write(uint32_t address, uint8_t* dat, size_t wordnum)
+{
+	spinor_call() ;
+
+	return program_command(address, dat, wordnum) ;
+}
+
+
+int spinor_readv(const nvmm_segment_t* segments, size_t num)
+{
+	size_t i ;
+
+	spinor_call() ;
+	for(i=0;i<num;i++)
+	{
+		if(read_command(segments[i].address, segments[i].buf, segments[i].len, segments[i].len) != 0)
+		{
+			return -1 ;
+		}
+	}
+
+	return 0 ;
+}
+
+
+int spinor_writev(const nvmm_segment_t* segments, size_t num)
+{
+	size_t i ;
+
+	spinor_call() ;
+	for(i=0;i<num;i++)
+	{
+		if(segments[i].len % SPINOR_WORD_SIZE || \
+			program_command(segments[i].address, segments[i].buf, segments[i].len / SPINOR_WORD_SIZE) != 0)
+		{
+			return -1 ;
+		}
+	}
+
+	return 0 ;
+}
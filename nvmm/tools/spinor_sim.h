@@ -0,0 +1,86 @@
+/*
+ * File Name: spinor_sim.h
+ * Author: PROJECTSUGAR
+ * Description: 
+ * Host side SPI NOR flash model for testing NVMM against external flash.
+ * It behaves like a typical SPI NOR chip:
+ * 		erasing works on whole sectors(4K bytes normally) only,
+ * 		programming can only clear bits and wraps around inside the program page(256 bytes normally),
+ * 		exactly the way a page program command crossing the page boundary corrupts the chip.
+ * Every command is counted and a simple latency model estimates the bus and busy time spent.
+ * The vectored methods carry out their segments one command each, in order, as a DMA or queued SPI driver would.
+     Copyright 2017 PROJECTSUGAR
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+ */
+#ifndef __SPINOR_SIM_H__
+#define __SPINOR_SIM_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "nvmm.h"
+
+/*
+ * chip geometry and timing, in nanoseconds.
+ */
+typedef struct{
+	uint32_t size ;
+	uint32_t sector_size ;
+	uint32_t page_size ;
+	uint32_t command_ns ;	//opcode, address and dummy cycles of one command, plus chip select overhead.
+	uint32_t call_ns ;		//driver overhead of a call to a method, a vectored call pays it once for all its commands.
+	uint32_t byte_ns ;		//transferring one byte.
+	uint32_t program_ns ;	//page program busy time.
+	uint32_t erase_ns ;		//sector erase busy time.
+}spinor_config_t ;
+
+/*
+ * command statistics.
+ */
+typedef struct{
+	uint32_t calls ;		//method calls, scalar and vectored.
+	uint32_t read_commands ;
+	uint32_t read_bytes ;
+	uint32_t program_commands ;
+	uint32_t program_bytes ;
+	uint32_t erase_commands ;
+	uint32_t page_wraps ;	//programs crossing a page boundary, the data wrapped and the chip is corrupted.
+	uint32_t misaligned ;	//erases not on a sector boundary.
+	double elapsed_ns ;
+}spinor_stats_t ;
+
+/*
+ * fill config with a common 4K sector, 256 bytes page chip on a 20MHz bus.
+ */
+void spinor_default_config(spinor_config_t* config, uint32_t size) ;
+
+/*
+ * create a blank(0xFF) chip.
+ * will return 0 for success, -1 for something error.
+ */
+int spinor_open(const spinor_config_t* config) ;
+void spinor_close(void) ;
+
+void spinor_get_stats(spinor_stats_t* stats) ;
+void spinor_reset_stats(void) ;
+
+/*
+ * NVMM flash operating methods.
+ */
+int spinor_read(uint32_t address, uint8_t* buf, size_t bufsize, size_t datlen) ;
+int spinor_write(uint32_t address, uint8_t* dat, size_t wordnum) ;
+int spinor_erase(uint32_t address) ;
+int spinor_readv(const nvmm_segment_t* segments, size_t num) ;
+int spinor_writev(const nvmm_segment_t* segments, size_t num) ;
+
+#endif /* SPINOR_SIM.H */